@@ -0,0 +1,352 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+
+#include "capture.h"
+#include "dtm_reader.h"
+#include "playback_clock.h"
+#include "wm_crypto.h"
+#include "wm_layout.h"
+
+//turns the wiimote -> console half of a wmmitm -capture into a dtm movie
+//and its key file, so a real session can be replayed by the emulator.
+//
+//extension bytes are decrypted with whichever key the console had set when
+//each report came in, then encrypted again with the last key of the
+//session, the one written to the key file. a session that changes keys
+//still makes a movie with a single key, as a dtm needs
+
+//dolphin counts vis at 60Hz
+#define DTM_VI_RATE 60
+
+struct capture_input
+{
+  uint64_t time;
+  uint8_t len;
+  uint8_t report[SPSC_RING_SLOT];
+};
+
+struct capture_key_change
+{
+  uint64_t time;
+  struct ext_crypto_state state;
+};
+
+struct capture_session
+{
+  struct capture_header header;
+
+  struct capture_input * inputs;
+  int input_count;
+
+  struct capture_key_change * keys;
+  int key_count;
+};
+
+static int load_capture(struct capture_session * session, const char * path)
+{
+  struct capture_record_header record;
+  uint8_t data[256];
+  int input_size = 0, key_size = 0;
+  FILE * f;
+
+  memset(session, 0, sizeof(struct capture_session));
+
+  f = fopen(path, "rb");
+  if (f == NULL)
+  {
+    printf("Unable to open %s\n", path);
+    return -1;
+  }
+
+  if (fread(&session->header, sizeof(session->header), 1, f) != 1 ||
+    session->header.magic != CAPTURE_MAGIC || session->header.version != CAPTURE_VERSION)
+  {
+    printf("%s isn't a wmmitm capture\n", path);
+    fclose(f);
+    return -1;
+  }
+
+  while (fread(&record, sizeof(record), 1, f) == 1)
+  {
+    if (fread(data, 1, record.len, f) != record.len)
+    {
+      printf("capture is truncated, using what was read\n");
+      break;
+    }
+
+    //the emulator answers requests itself, only data reports are inputs
+    if (record.type == CAPTURE_INPUT && record.len >= 2 && report_get_layout(data[1]) != NULL)
+    {
+      if (session->input_count == input_size)
+      {
+        input_size = input_size ? input_size * 2 : 4096;
+        session->inputs = (struct capture_input *)realloc(session->inputs, input_size * sizeof(struct capture_input));
+        if (session->inputs == NULL) break;
+      }
+
+      struct capture_input * input = &session->inputs[session->input_count++];
+      input->time = record.time;
+      input->len = (record.len < SPSC_RING_SLOT) ? record.len : SPSC_RING_SLOT;
+      memcpy(input->report, data, input->len);
+    }
+    else if (record.type == CAPTURE_KEY && record.len == 16)
+    {
+      if (session->key_count == key_size)
+      {
+        key_size = key_size ? key_size * 2 : 16;
+        session->keys = (struct capture_key_change *)realloc(session->keys, key_size * sizeof(struct capture_key_change));
+        if (session->keys == NULL) break;
+      }
+
+      struct capture_key_change * key = &session->keys[session->key_count++];
+      key->time = record.time;
+      ext_generate_tables(&key->state, data);
+    }
+  }
+
+  fclose(f);
+
+  if ((input_size && session->inputs == NULL) || (key_size && session->keys == NULL))
+  {
+    printf("out of memory reading %s\n", path);
+    return -1;
+  }
+
+  if (session->input_count == 0)
+  {
+    printf("%s has no wiimote data reports\n", path);
+    return -1;
+  }
+
+  return 0;
+}
+
+static int by_time(const void * a, const void * b)
+{
+  uint64_t ta = ((const struct capture_key_change *)a)->time;
+  uint64_t tb = ((const struct capture_key_change *)b)->time;
+
+  return (ta > tb) - (ta < tb);
+}
+
+//inputs are in time order already, key records are written by another
+//thread and can land a few ms late in the file
+static void decrypt_inputs(struct capture_session * session)
+{
+  const struct ext_crypto_state * state = NULL;
+  int i, key = 0;
+
+  qsort(session->keys, session->key_count, sizeof(struct capture_key_change), by_time);
+
+  for (i = 0; i < session->input_count; i++)
+  {
+    struct capture_input * input = &session->inputs[i];
+    const struct report_layout * layout = report_get_layout(input->report[1]);
+
+    while (key < session->key_count && session->keys[key].time <= input->time)
+    {
+      state = &session->keys[key++].state;
+    }
+
+    //before the first key the extension isn't encrypted
+    if (state != NULL && layout->extension >= 0 && 2 + layout->extension + layout->extension_length <= input->len)
+    {
+      ext_decrypt_bytes(state, input->report + 2 + layout->extension, 0x08, layout->extension_length);
+    }
+  }
+}
+
+static void put_u64(uint8_t * buf, uint64_t value)
+{
+  int i;
+
+  for (i = 0; i < 8; i++)
+  {
+    buf[i] = value >> (i * 8);
+  }
+}
+
+//one report per tick at rate_hz, the one the console would have had last,
+//returns the number of records written
+static int write_movie(const struct capture_session * session, const char * path,
+  const struct ext_crypto_state * state, unsigned int rate_hz)
+{
+  uint8_t header[DTM_HEADER_SIZE];
+  uint8_t report[SPSC_RING_SLOT];
+  uint64_t start = session->inputs[0].time;
+  uint64_t end = session->inputs[session->input_count - 1].time;
+  uint64_t tick, ticks = (end - start) * rate_hz / 1000000 + 1;
+  int i = 0;
+  FILE * f;
+
+  f = fopen(path, "wb");
+  if (f == NULL)
+  {
+    printf("Unable to open %s\n", path);
+    return -1;
+  }
+
+  memset(header, 0, sizeof(header));
+  memcpy(header, DTM_SIGNATURE, 4);
+  header[DTM_HEADER_IS_WII] = 1;
+  header[DTM_HEADER_CONTROLLERS] = 0x10; //wiimote 1
+  put_u64(header + DTM_HEADER_FRAME_COUNT, (end - start) * DTM_VI_RATE / 1000000 + 1);
+  put_u64(header + DTM_HEADER_INPUT_COUNT, ticks);
+  fwrite(header, sizeof(header), 1, f);
+
+  for (tick = 0; tick < ticks; tick++)
+  {
+    uint64_t time = start + tick * 1000000 / rate_hz;
+    const struct capture_input * input;
+    const struct report_layout * layout;
+
+    while (i + 1 < session->input_count && session->inputs[i + 1].time <= time)
+    {
+      i++;
+    }
+    input = &session->inputs[i];
+    layout = report_get_layout(input->report[1]);
+
+    memcpy(report, input->report, input->len);
+    if (layout->extension >= 0 && 2 + layout->extension + layout->extension_length <= input->len)
+    {
+      ext_encrypt_bytes(state, report + 2 + layout->extension, 0x08, layout->extension_length);
+    }
+
+    fputc(input->len, f);
+    fwrite(report, input->len, 1, f);
+  }
+
+  if (fclose(f) != 0)
+  {
+    printf("Unable to write %s\n", path);
+    return -1;
+  }
+
+  return ticks;
+}
+
+//16 space separated hex bytes, the tables dtm_reader decrypts with
+static int write_key(const char * path, const struct ext_crypto_state * state)
+{
+  const uint8_t * bytes = (const uint8_t *)state;
+  FILE * f;
+  int i;
+
+  f = fopen(path, "w");
+  if (f == NULL)
+  {
+    printf("Unable to open %s\n", path);
+    return -1;
+  }
+
+  for (i = 0; i < 16; i++)
+  {
+    fprintf(f, "%02x%c", bytes[i], (i == 15) ? '\n' : ' ');
+  }
+
+  return (fclose(f) == 0) ? 0 : -1;
+}
+
+//<movie>.txt next to the movie, so taskey.txt is only written when asked for
+static void default_key_path(char * key_path, size_t size, const char * movie_path)
+{
+  size_t len = strlen(movie_path);
+
+  if (len > 4 && strcmp(movie_path + len - 4, ".dtm") == 0)
+  {
+    len -= 4;
+  }
+  snprintf(key_path, size, "%.*s.txt", (int)len, movie_path);
+}
+
+void print_usage(char * argv0)
+{
+  printf("usage: %s <capture> <movie.dtm> [ -key <key.txt> ] [ -rate <hz> ]\n", argv0);
+  printf("the key goes next to the movie as <movie>.txt unless -key is given\n");
+}
+
+int main(int argc, char *argv[])
+{
+  const char * capture_path = NULL;
+  const char * movie_path = NULL;
+  const char * key_path = NULL;
+  char movie_key_path[PATH_MAX];
+  unsigned int rate_hz = PLAYBACK_RATE_DEFAULT;
+  struct capture_session session;
+  struct ext_crypto_state plain;
+  const struct ext_crypto_state * state;
+  int i, records;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-key") == 0 && i + 1 < argc)
+    {
+      key_path = argv[++i];
+    }
+    else if (strcmp(argv[i], "-rate") == 0 && i + 1 < argc)
+    {
+      rate_hz = atoi(argv[++i]);
+    }
+    else if (capture_path == NULL)
+    {
+      capture_path = argv[i];
+    }
+    else if (movie_path == NULL)
+    {
+      movie_path = argv[i];
+    }
+    else
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (capture_path == NULL || movie_path == NULL || rate_hz == 0 || rate_hz > 1000)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (key_path == NULL)
+  {
+    default_key_path(movie_key_path, sizeof(movie_key_path), movie_path);
+    key_path = movie_key_path;
+  }
+
+  if (load_capture(&session, capture_path) < 0)
+  {
+    return 1;
+  }
+
+  decrypt_inputs(&session);
+
+  //all zero tables leave bytes as they are, for sessions that never set a key
+  memset(&plain, 0, sizeof(plain));
+  state = session.key_count ? &session.keys[session.key_count - 1].state : &plain;
+  if (session.key_count == 0)
+  {
+    printf("no extension key in the capture, writing the extension bytes as they are\n");
+  }
+
+  records = write_movie(&session, movie_path, state, rate_hz);
+  if (records < 0 || write_key(key_path, state) < 0)
+  {
+    return 1;
+  }
+
+  printf("%d reports over %.1f s written to %s at %u Hz, key in %s\n", records,
+    (session.inputs[session.input_count - 1].time - session.inputs[0].time) / 1e6,
+    movie_path, rate_hz, key_path);
+  if (session.key_count > 1)
+  {
+    printf("the console set %d keys, everything is under the last one\n", session.key_count);
+  }
+
+  free(session.inputs);
+  free(session.keys);
+  return 0;
+}
@@ -0,0 +1,204 @@
+#include "capture.h"
+#include "wm_time.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+//how long the writer sleeps between draining the rings
+#define CAPTURE_POLL_MS 10
+
+static int capture_flush(struct capture * cap)
+{
+  int done = 0;
+  ssize_t len;
+
+  while (done < cap->buf_len)
+  {
+    len = write(cap->fd, cap->buf + done, cap->buf_len - done);
+    if (len < 0)
+    {
+      if (errno == EINTR) continue;
+      printf("capture write failed: %s\n", strerror(errno));
+      cap->buf_len = 0;
+      return -1;
+    }
+    done += len;
+  }
+
+  cap->buf_len = 0;
+  cap->last_flush = wm_time_us();
+  return 0;
+}
+
+static void capture_append(struct capture * cap, enum capture_record_type type, const struct spsc_ring_slot * slot)
+{
+  struct capture_record_header record;
+
+  if (cap->buf_len + sizeof(record) + slot->len > CAPTURE_BUFFER_SIZE)
+  {
+    capture_flush(cap);
+  }
+
+  record.time = (slot->time > cap->header.start) ? slot->time - cap->header.start : 0;
+  record.type = type;
+  record.len = slot->len;
+
+  memcpy(cap->buf + cap->buf_len, &record, sizeof(record));
+  memcpy(cap->buf + cap->buf_len + sizeof(record), slot->data, slot->len);
+  cap->buf_len += sizeof(record) + slot->len;
+  cap->header.record_count++;
+
+  if (type == CAPTURE_KEY && slot->len == sizeof(cap->header.key))
+  {
+    memcpy(cap->header.key, slot->data, sizeof(cap->header.key));
+    cap->header.has_key = 1;
+  }
+}
+
+//moves everything queued so far into the buffer, oldest first across rings
+static void capture_drain(struct capture * cap)
+{
+  struct spsc_ring * rings[3] = { &cap->input, &cap->output, &cap->key };
+  static const enum capture_record_type types[3] = { CAPTURE_INPUT, CAPTURE_OUTPUT, CAPTURE_KEY };
+  const struct spsc_ring_slot * slots[3];
+  int i, oldest;
+
+  while (true)
+  {
+    oldest = -1;
+    for (i = 0; i < 3; i++)
+    {
+      slots[i] = spsc_ring_peek(rings[i]);
+      if (slots[i] != NULL && (oldest < 0 || slots[i]->time < slots[oldest]->time))
+      {
+        oldest = i;
+      }
+    }
+
+    if (oldest < 0) break;
+
+    capture_append(cap, types[oldest], slots[oldest]);
+    spsc_ring_pop(rings[oldest]);
+  }
+}
+
+static void * capture_writer(void * arg)
+{
+  struct capture * cap = (struct capture *)arg;
+
+  while (__atomic_load_n(&cap->running, __ATOMIC_RELAXED))
+  {
+    capture_drain(cap);
+
+    if (cap->buf_len > 0 && wm_time_us() - cap->last_flush >= CAPTURE_FLUSH_MS * 1000)
+    {
+      capture_flush(cap);
+    }
+
+    usleep(CAPTURE_POLL_MS * 1000);
+  }
+
+  capture_drain(cap);
+  capture_flush(cap);
+
+  return NULL;
+}
+
+int capture_open(struct capture * cap, const char * path, const uint8_t * host_device,
+  const uint8_t * wiimote_device, const uint8_t * host, const uint8_t * wiimote)
+{
+  memset(cap, 0, sizeof(struct capture));
+  cap->fd = -1;
+
+  cap->header.magic = CAPTURE_MAGIC;
+  cap->header.version = CAPTURE_VERSION;
+  memcpy(cap->header.host_device, host_device, 6);
+  memcpy(cap->header.wiimote_device, wiimote_device, 6);
+  memcpy(cap->header.host, host, 6);
+  memcpy(cap->header.wiimote, wiimote, 6);
+  cap->header.start = wm_time_us();
+
+  cap->buf = (uint8_t *)malloc(CAPTURE_BUFFER_SIZE);
+  if (cap->buf == NULL)
+  {
+    printf("Unable to allocate capture buffer\n");
+    return -1;
+  }
+
+  cap->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (cap->fd < 0)
+  {
+    printf("Unable to open %s: %s\n", path, strerror(errno));
+    free(cap->buf);
+    cap->buf = NULL;
+    return -1;
+  }
+
+  //the counts and key are only known at close, this keeps the records where
+  //they belong and the file readable if we never get there
+  memcpy(cap->buf, &cap->header, sizeof(cap->header));
+  cap->buf_len = sizeof(cap->header);
+  cap->last_flush = cap->header.start;
+
+  cap->running = 1;
+  if (pthread_create(&cap->thread, NULL, capture_writer, cap) != 0)
+  {
+    printf("Unable to start capture writer\n");
+    close(cap->fd);
+    cap->fd = -1;
+    free(cap->buf);
+    cap->buf = NULL;
+    return -1;
+  }
+
+  cap->started = true;
+  return 0;
+}
+
+void capture_close(struct capture * cap)
+{
+  if (!cap->started) return;
+
+  __atomic_store_n(&cap->running, 0, __ATOMIC_RELAXED);
+  pthread_join(cap->thread, NULL);
+  cap->started = false;
+
+  if (pwrite(cap->fd, &cap->header, sizeof(cap->header), 0) != sizeof(cap->header))
+  {
+    printf("Unable to write capture header: %s\n", strerror(errno));
+  }
+
+  printf("capture: %llu records", (unsigned long long)cap->header.record_count);
+  if (spsc_ring_dropped(&cap->input) || spsc_ring_dropped(&cap->output) || spsc_ring_dropped(&cap->key))
+  {
+    printf(", dropped %llu input, %llu output and %llu key records",
+      (unsigned long long)spsc_ring_dropped(&cap->input),
+      (unsigned long long)spsc_ring_dropped(&cap->output),
+      (unsigned long long)spsc_ring_dropped(&cap->key));
+  }
+  printf("\n");
+
+  close(cap->fd);
+  cap->fd = -1;
+  free(cap->buf);
+  cap->buf = NULL;
+}
+
+void capture_input(struct capture * cap, const uint8_t * buf, int len, uint64_t time)
+{
+  spsc_ring_push(&cap->input, buf, len, time);
+}
+
+void capture_output(struct capture * cap, const uint8_t * buf, int len, uint64_t time)
+{
+  spsc_ring_push(&cap->output, buf, len, time);
+}
+
+void capture_key(struct capture * cap, const uint8_t * key, uint64_t time)
+{
+  spsc_ring_push(&cap->key, key, 16, time);
+}
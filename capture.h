@@ -0,0 +1,91 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include "spsc_ring.h"
+
+//binary log of a wmmitm session. the file starts with a capture_header,
+//followed by records of a capture_record_header and len bytes of report:
+//
+//  input   wiimote -> console report, 0xa1 io byte first
+//  output  console -> wiimote report, 0xa2 io byte first
+//  key     16 byte extension key, as soon as the host finishes writing one
+//
+//times are wm_time_us relative to the start of the capture. records of one
+//type are in time order, across types they can be a few ms apart. all
+//fields are in host byte order
+
+#define CAPTURE_MAGIC 0x50434d57 //"WMCP"
+#define CAPTURE_VERSION 1
+
+enum capture_record_type
+{
+  CAPTURE_INPUT = 1,
+  CAPTURE_OUTPUT = 2,
+  CAPTURE_KEY = 3,
+};
+
+struct capture_header
+{
+  uint32_t magic;
+  uint32_t version;
+  uint8_t host_device[6]; //adapter facing the console
+  uint8_t wiimote_device[6]; //adapter facing the wiimote
+  uint8_t host[6]; //the console
+  uint8_t wiimote[6];
+  uint8_t key[16]; //last extension key, only filled in at close
+  uint8_t has_key;
+  uint8_t reserved[7];
+  uint64_t start; //wm_time_us of time 0
+  uint64_t record_count; //only filled in at close
+} __attribute__((packed));
+
+struct capture_record_header
+{
+  uint64_t time;
+  uint8_t type;
+  uint8_t len;
+} __attribute__((packed));
+
+//records are gathered into this much memory before each write
+#define CAPTURE_BUFFER_SIZE (256 * 1024)
+//and written at least this often, in ms, so a crash loses little
+#define CAPTURE_FLUSH_MS 1000
+
+//the forwarding threads and the key sniffer each push into their own ring
+//and a writer thread turns them into the file, so none of them ever waits
+//on the disk. a full ring drops the record and counts it
+struct capture
+{
+  int fd;
+  bool started;
+  int running;
+  pthread_t thread;
+
+  struct capture_header header;
+
+  struct spsc_ring input; //wiimote -> console
+  struct spsc_ring output; //console -> wiimote
+  struct spsc_ring key;
+
+  //writer thread only
+  uint8_t * buf;
+  int buf_len;
+  uint64_t last_flush;
+};
+
+//bdaddrs are the 6 bytes of a bdaddr_t
+int capture_open(struct capture * cap, const char * path, const uint8_t * host_device,
+  const uint8_t * wiimote_device, const uint8_t * host, const uint8_t * wiimote);
+//writes out everything still queued, then the final header
+void capture_close(struct capture * cap);
+
+//time is wm_time_us when the report came in
+void capture_input(struct capture * cap, const uint8_t * buf, int len, uint64_t time);
+void capture_output(struct capture * cap, const uint8_t * buf, int len, uint64_t time);
+void capture_key(struct capture * cap, const uint8_t * key, uint64_t time);
+
+#endif
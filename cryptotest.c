@@ -0,0 +1,284 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wm_crypto.h"
+#include "wm_crypto_tables.h"
+
+//checks ext_generate_tables against the brute force idx search it replaced,
+//then ext_encrypt_bytes, ext_decrypt_bytes and ext_decrypt_spans byte for
+//byte against one byte at a time reference routines, over random keys,
+//offsets, lengths and buffer alignments, then the key cache against
+//ext_generate_tables
+
+#define TEST_KEYS 200
+#define TEST_MAX_LENGTH 64
+#define TEST_SPANS 32
+#define TEST_TABLE_KEYS 200000
+
+static inline uint8_t ror8(uint8_t a, uint8_t b)
+{
+  return (a>>b) | ((a<<(8-b))&0xff);
+}
+
+//the original ext_generate_tables, tries each answer row until one fits
+static void reference_generate_tables(struct ext_crypto_state * state, const uint8_t key[16])
+{
+  int idx, i;
+  const uint8_t * ans;
+  uint8_t t0[10];
+
+  //determine idx with simple brute force
+  for (idx = 0; idx < 7; idx++)
+  {
+    ans = ans_tbl[idx];
+
+    for(i = 0; i < 10; i++)
+    {
+      t0[i] = sboxes[0][key[9 - i]];
+    }
+
+    if ((key[0xf] == (uint8_t)((ror8(ans[0]^t0[5],t0[2]%8) - t0[9]) ^ t0[4])) &&
+      (key[0xe] == (uint8_t)((ror8(ans[1]^t0[1],t0[0]%8) - t0[5]) ^ t0[7])) &&
+      (key[0xd] == (uint8_t)((ror8(ans[2]^t0[6],t0[8]%8) - t0[2]) ^ t0[0])) &&
+      (key[0xc] == (uint8_t)((ror8(ans[3]^t0[4],t0[7]%8) - t0[3]) ^ t0[2])) &&
+      (key[0xb] == (uint8_t)((ror8(ans[4]^t0[1],t0[6]%8) - t0[3]) ^ t0[4])) &&
+      (key[0xa] == (uint8_t)((ror8(ans[5]^t0[7],t0[8]%8) - t0[5]) ^ t0[9])))
+    {
+      break;
+    }
+  }
+
+  state->ft[0] = sboxes[idx+1][key[0xb]] ^ sboxes[idx+2][key[0x6]];
+  state->ft[1] = sboxes[idx+1][key[0xd]] ^ sboxes[idx+2][key[0x4]];
+  state->ft[2] = sboxes[idx+1][key[0xa]] ^ sboxes[idx+2][key[0x2]];
+  state->ft[3] = sboxes[idx+1][key[0xf]] ^ sboxes[idx+2][key[0x7]];
+  state->ft[4] = sboxes[idx+1][key[0xe]] ^ sboxes[idx+2][key[0x5]];
+  state->ft[5] = sboxes[idx+1][key[0xc]] ^ sboxes[idx+2][key[0x0]];
+  state->ft[6] = sboxes[idx+1][key[0x9]] ^ sboxes[idx+2][key[0x3]];
+  state->ft[7] = sboxes[idx+1][key[0x8]] ^ sboxes[idx+2][key[0x1]];
+
+  state->sb[0] = sboxes[idx+1][key[0xf]] ^ sboxes[idx+2][key[0x8]];
+  state->sb[1] = sboxes[idx+1][key[0xa]] ^ sboxes[idx+2][key[0x5]];
+  state->sb[2] = sboxes[idx+1][key[0xc]] ^ sboxes[idx+2][key[0x9]];
+  state->sb[3] = sboxes[idx+1][key[0xd]] ^ sboxes[idx+2][key[0x0]];
+  state->sb[4] = sboxes[idx+1][key[0xb]] ^ sboxes[idx+2][key[0x2]];
+  state->sb[5] = sboxes[idx+1][key[0xe]] ^ sboxes[idx+2][key[0x1]];
+  state->sb[6] = sboxes[idx+1][key[0x6]] ^ sboxes[idx+2][key[0x4]];
+  state->sb[7] = sboxes[idx+1][key[0x7]] ^ sboxes[idx+2][key[0x3]];
+}
+
+//random key[0..9] with key[0xa..0xf] derived from answer row idx, the way a
+//host builds a key the brute force would find
+static void make_row_key(uint8_t key[16], int idx)
+{
+  const uint8_t * ans = ans_tbl[idx];
+  uint8_t t0[10];
+  int i;
+
+  for (i = 0; i < 10; i++)
+  {
+    key[i] = rand();
+  }
+  for (i = 0; i < 10; i++)
+  {
+    t0[i] = sboxes[0][key[9 - i]];
+  }
+
+  key[0xf] = (ror8(ans[0]^t0[5],t0[2]%8) - t0[9]) ^ t0[4];
+  key[0xe] = (ror8(ans[1]^t0[1],t0[0]%8) - t0[5]) ^ t0[7];
+  key[0xd] = (ror8(ans[2]^t0[6],t0[8]%8) - t0[2]) ^ t0[0];
+  key[0xc] = (ror8(ans[3]^t0[4],t0[7]%8) - t0[3]) ^ t0[2];
+  key[0xb] = (ror8(ans[4]^t0[1],t0[6]%8) - t0[3]) ^ t0[4];
+  key[0xa] = (ror8(ans[5]^t0[7],t0[8]%8) - t0[5]) ^ t0[9];
+}
+
+static void reference_encrypt(const struct ext_crypto_state * state, uint8_t * buffer,
+  int addr_offset, int length)
+{
+  for (int i = 0; i < length; i++)
+  {
+    buffer[i] = (buffer[i] - state->ft[(i + addr_offset) % 8]) ^ state->sb[(i + addr_offset) % 8];
+  }
+}
+
+static void reference_decrypt(const struct ext_crypto_state * state, uint8_t * buffer,
+  int addr_offset, int length)
+{
+  for (int i = 0; i < length; i++)
+  {
+    buffer[i] = ((buffer[i] ^ state->sb[(i + addr_offset) % 8]) + state->ft[(i + addr_offset) % 8]);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct ext_crypto_state state;
+  uint8_t key[16];
+  uint8_t plain[TEST_MAX_LENGTH + 16];
+  uint8_t expected[TEST_MAX_LENGTH + 16];
+  uint8_t actual[TEST_MAX_LENGTH + 16];
+  int k, i, offset, length, align;
+  int checks = 0, failures = 0;
+
+  srand(argc > 1 ? atoi(argv[1]) : 1);
+
+  //random keys mostly fit no row, the ones hosts send fit exactly one
+  for (k = 0; k < TEST_TABLE_KEYS; k++)
+  {
+    struct ext_crypto_state reference;
+
+    if (k % 2)
+    {
+      make_row_key(key, (k / 2) % 7);
+    }
+    else
+    {
+      for (i = 0; i < 16; i++)
+      {
+        key[i] = rand();
+      }
+    }
+
+    reference_generate_tables(&reference, key);
+    ext_generate_tables(&state, key);
+    checks++;
+    if (memcmp(reference.ft, state.ft, sizeof(state.ft)) != 0 ||
+      memcmp(reference.sb, state.sb, sizeof(state.sb)) != 0)
+    {
+      printf("table mismatch: key %d%s\n", k, (k % 2) ? " built from an answer row" : "");
+      failures++;
+    }
+  }
+
+  for (k = 0; k < TEST_KEYS; k++)
+  {
+    for (i = 0; i < 16; i++)
+    {
+      key[i] = rand();
+    }
+    ext_generate_tables(&state, key);
+
+    for (offset = 0; offset < 16; offset++)
+    {
+      for (length = 0; length <= TEST_MAX_LENGTH; length++)
+      {
+        align = rand() % 16;
+        for (i = 0; i < length; i++)
+        {
+          plain[i] = rand();
+        }
+
+        memcpy(expected, plain, length);
+        memcpy(actual + align, plain, length);
+        reference_encrypt(&state, expected, offset, length);
+        ext_encrypt_bytes(&state, actual + align, offset, length);
+        checks++;
+        if (memcmp(expected, actual + align, length) != 0)
+        {
+          printf("encrypt mismatch: key %d offset %d length %d\n", k, offset, length);
+          failures++;
+        }
+
+        memcpy(expected, plain, length);
+        memcpy(actual + align, plain, length);
+        reference_decrypt(&state, expected, offset, length);
+        ext_decrypt_bytes(&state, actual + align, offset, length);
+        checks++;
+        if (memcmp(expected, actual + align, length) != 0)
+        {
+          printf("decrypt mismatch: key %d offset %d length %d\n", k, offset, length);
+          failures++;
+        }
+      }
+    }
+  }
+
+  //a whole capture's worth of scattered spans in one call
+  for (k = 0; k < TEST_KEYS; k++)
+  {
+    struct ext_crypto_span spans[TEST_SPANS];
+    uint8_t capture[TEST_SPANS * TEST_MAX_LENGTH];
+    uint8_t reference[TEST_SPANS * TEST_MAX_LENGTH];
+
+    for (i = 0; i < 16; i++)
+    {
+      key[i] = rand();
+    }
+    ext_generate_tables(&state, key);
+
+    for (i = 0; i < (int)sizeof(capture); i++)
+    {
+      capture[i] = reference[i] = rand();
+    }
+
+    for (i = 0; i < TEST_SPANS; i++)
+    {
+      spans[i].buffer = capture + i * TEST_MAX_LENGTH + rand() % 8;
+      spans[i].addr_offset = rand() % 256;
+      spans[i].length = rand() % (TEST_MAX_LENGTH - 8);
+      reference_decrypt(&state, reference + (spans[i].buffer - capture),
+        spans[i].addr_offset, spans[i].length);
+    }
+
+    ext_decrypt_spans(&state, spans, TEST_SPANS);
+    checks++;
+    if (memcmp(capture, reference, sizeof(capture)) != 0)
+    {
+      printf("span mismatch: key %d\n", k);
+      failures++;
+    }
+
+    //and back again
+    for (i = 0; i < TEST_SPANS; i++)
+    {
+      ext_encrypt_bytes(&state, spans[i].buffer, spans[i].addr_offset, spans[i].length);
+      reference_encrypt(&state, reference + (spans[i].buffer - capture),
+        spans[i].addr_offset, spans[i].length);
+    }
+    checks++;
+    if (memcmp(capture, reference, sizeof(capture)) != 0)
+    {
+      printf("round trip mismatch: key %d\n", k);
+      failures++;
+    }
+  }
+
+  //more keys than the cache holds, each sent twice in a row
+  struct ext_key_cache cache;
+  struct ext_crypto_state cached;
+  uint8_t keys[EXT_KEY_CACHE_SIZE * 2][16];
+
+  memset(&cache, 0, sizeof(cache));
+  for (k = 0; k < EXT_KEY_CACHE_SIZE * 2; k++)
+  {
+    for (i = 0; i < 16; i++)
+    {
+      keys[k][i] = rand();
+    }
+  }
+
+  for (k = 0; k < EXT_KEY_CACHE_SIZE * 4; k++)
+  {
+    const uint8_t * next = keys[(k / 2) % (EXT_KEY_CACHE_SIZE * 2)];
+
+    ext_generate_tables(&state, next);
+    ext_generate_tables_cached(&cache, &cached, next);
+    checks++;
+    if (memcmp(&state, &cached, sizeof(state)) != 0)
+    {
+      printf("key cache mismatch: key %d\n", k);
+      failures++;
+    }
+  }
+
+  checks++;
+  if (cache.hits != EXT_KEY_CACHE_SIZE * 2 || cache.misses != EXT_KEY_CACHE_SIZE * 2)
+  {
+    printf("key cache counted %u hits, %u misses\n", cache.hits, cache.misses);
+    failures++;
+  }
+
+  printf("%d of %d checks failed\n", failures, checks);
+  return failures != 0;
+}
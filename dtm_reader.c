@@ -1,89 +1,696 @@
 #include "dtm_reader.h"
+#include "wm_layout.h"
 
-static FILE *dtm = NULL;
-static uint8_t key[16] = {0};
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+enum dtm_playlist_entry_state
+{
+  DTM_ENTRY_QUEUED, //waiting for the decode thread
+  DTM_ENTRY_DECODING,
+  DTM_ENTRY_READY,
+  DTM_ENTRY_FAILED, //skipped when its turn comes
+};
+
+//movies queued for playback, each opened when it's queued so the next one
+//can start the moment the current one ends
+struct dtm_playlist_entry
+{
+  struct dtm_replay replay;
+  char path[PATH_MAX];
+  char key_path[PATH_MAX];
+  enum dtm_playlist_entry_state state;
+  uint32_t generation; //playlist_generation when it was queued
+};
+
+//the decode thread only reads the playlist and fills in entries it took,
+//everything else is the event loop's. the lock is held to change the
+//playlist or to read an entry's state
+static pthread_mutex_t playlist_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t playlist_queued = PTHREAD_COND_INITIALIZER;
+static struct dtm_playlist_entry playlist[DTM_PLAYLIST_SIZE];
+static int playlist_head; //entry being played
+static int playlist_count;
+static uint32_t playlist_generation; //bumped by clear, so stale decodes are dropped
+static int playlist_fd = -1; //eventfd, readable when a decode finishes
 
 // returns 0 on success
-static int load_dtm(void)
+static int load_key(const char * key_path, uint8_t key[16])
 {
-  // load extension decryption key
-  FILE *keyf = fopen(DEFAULT_KEY, "r");
+  FILE *keyf = fopen(key_path, "r");
   if (keyf == NULL)
   {
-    fprintf(stderr, "Error opening dtm encryption key: '%s'\n", DEFAULT_KEY);
+    fprintf(stderr, "Error opening dtm encryption key: '%s'\n", key_path);
     return -1;
   }
   int data;
   for (int i = 0; i < 16; ++i)
   {
     if (fscanf(keyf, "%x", &data) != 1) {
-      fprintf(stderr, "Error reading dtm encryption key. Ensure '%s' has 16 space separated hexadecimal bytes.\n", DEFAULT_KEY);
+      fprintf(stderr, "Error reading dtm encryption key. Ensure '%s' has 16 space separated hexadecimal bytes.\n", key_path);
+      fclose(keyf);
       return -1;
     }
     key[i] = (uint8_t)data;
   }
   fclose(keyf);
+  return 0;
+}
+
+int dtm_open(struct dtm_movie * movie, const char * path, const char * key_path)
+{
+  struct stat st;
+  void * data;
+  int fd;
+
+  memset(movie, 0, sizeof(struct dtm_movie));
+
+  if (load_key(key_path, movie->key))
+  {
+    return -1;
+  }
+
+  fd = open(path, O_RDONLY);
+  if (fd < 0)
+  {
+    fprintf(stderr, "Error opening dtm '%s': %s\n", path, strerror(errno));
+    return -1;
+  }
+
+  if (fstat(fd, &st) < 0 || st.st_size <= DTM_HEADER_SIZE)
+  {
+    fprintf(stderr, "Error opening dtm '%s': no reports\n", path);
+    close(fd);
+    return -1;
+  }
 
-  // load dtm
-  dtm = fopen(DEFAULT_TAS, "rb");
-  if (dtm == NULL)
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd); //the mapping keeps the file open
+  if (data == MAP_FAILED)
   {
-    fprintf(stderr, "Error opening dtm\n");
+    fprintf(stderr, "Error mapping dtm '%s': %s\n", path, strerror(errno));
     return -1;
   }
-  fseek(dtm, 0x100, SEEK_SET); // skip header
+
+  //playback walks the file front to back, let the kernel read ahead
+  madvise(data, st.st_size, MADV_SEQUENTIAL);
+  madvise(data, st.st_size, MADV_WILLNEED);
+
+  movie->data = (const uint8_t *)data;
+  movie->size = st.st_size;
+  movie->mtime = st.st_mtim.tv_sec * (int64_t)1000000000 + st.st_mtim.tv_nsec;
+  movie->cursor = DTM_HEADER_SIZE; // skip header
+
+  for (int i = 7; i >= 0; i--)
+  {
+    movie->frame_count = (movie->frame_count << 8) | movie->data[DTM_HEADER_FRAME_COUNT + i];
+  }
+
   return 0;
 }
 
-// returns the length of buf
-int next_dtm_report(struct wiimote_state *state, uint8_t *buf)
+void dtm_close(struct dtm_movie * movie)
 {
-  if (dtm == NULL && load_dtm())
+  if (movie->data != NULL)
   {
-    return 0;
+    munmap((void *)movie->data, movie->size);
+    movie->data = NULL;
   }
+}
 
+int dtm_next_record(struct dtm_movie * movie, const uint8_t ** report)
+{
   uint8_t len;
-  if (
-    fread(&len, sizeof(len), 1, dtm) == 0 || // read length
-    fread(buf, sizeof(uint8_t) * len, len, dtm) == 0 // read encrypted report
-  ) {
-    fclose(dtm);
-    dtm = NULL;
+
+  if (movie->data == NULL || movie->cursor >= movie->size)
+  {
     return 0;
   }
 
-  // re-encrypt extension data
-  int offset = 0, ext_len = 0;
-  switch (buf[1])
+  len = movie->data[movie->cursor];
+  if (len == 0 || movie->size - movie->cursor - 1 < len)
   {
-    case 0x32:
-      offset = 4, ext_len = 8;
-      break;
-    case 0x34:
-      offset = 4, ext_len = 19;
-      break;
-    case 0x35:
-      offset = 7, ext_len = 16;
-      break;
-    case 0x36:
-      offset = 14, ext_len = 9;
-      break;
-    case 0x37:
-      offset = 17, ext_len = 6;
-      break;
-    case 0x3D:
-      offset = 2, ext_len = 21;
-      break;
+    //truncated record
+    movie->cursor = movie->size;
+    return 0;
   }
 
-  if (ext_len)
+  *report = movie->data + movie->cursor + 1;
+  movie->cursor += 1 + len;
+  return (int)len;
+}
+
+// returns 0 if the cache file exists and was made from this movie and key
+static int map_cache(struct dtm_replay * replay, const char * cache_path,
+  const struct dtm_movie * movie)
+{
+  const struct dtm_cache_header * header;
+  struct stat st;
+  void * data;
+  int fd;
+
+  fd = open(cache_path, O_RDONLY);
+  if (fd < 0)
   {
-    ext_decrypt_bytes((struct ext_crypto_state *)&key, buf + offset, 0, ext_len);
+    return -1;
   }
-  if (state->sys.extension_encrypted)
+
+  if (fstat(fd, &st) < 0 || st.st_size < (off_t)sizeof(struct dtm_cache_header))
   {
-    ext_encrypt_bytes(&state->sys.extension_crypto_state, buf + offset, 0, ext_len);
+    close(fd);
+    return -1;
   }
-  return (int)len;
+
+  data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (data == MAP_FAILED)
+  {
+    return -1;
+  }
+
+  header = (const struct dtm_cache_header *)data;
+  if (header->magic != DTM_CACHE_MAGIC ||
+    header->version != DTM_CACHE_VERSION ||
+    header->source_size != movie->size ||
+    header->source_mtime != movie->mtime ||
+    memcmp(header->key, movie->key, 16) != 0 ||
+    (size_t)st.st_size != sizeof(struct dtm_cache_header) +
+      (size_t)header->record_count * sizeof(struct dtm_record))
+  {
+    munmap(data, st.st_size);
+    return -1;
+  }
+
+  replay->base = data;
+  replay->size = st.st_size;
+  replay->mapped = true;
+  replay->records = (const struct dtm_record *)(header + 1);
+  replay->count = header->record_count;
+  replay->frame_count = header->frame_count;
+  return 0;
+}
+
+// decodes the whole movie into memory and tries to save it as the cache
+// returns 0 on success
+static int build_cache(struct dtm_replay * replay, const char * cache_path,
+  struct dtm_movie * movie)
+{
+  struct dtm_cache_header * header;
+  struct dtm_record * records;
+  struct ext_crypto_span * spans;
+  const uint8_t * report;
+  uint32_t count = 0, span_count = 0, i;
+  int len;
+
+  //count first, so a long movie is allocated exactly once
+  while ((len = dtm_next_record(movie, &report)) > 0 && len <= DTM_RECORD_REPORT_SIZE)
+  {
+    count++;
+  }
+  movie->cursor = DTM_HEADER_SIZE;
+
+  replay->size = sizeof(struct dtm_cache_header) + (size_t)count * sizeof(struct dtm_record);
+  replay->base = calloc(1, replay->size);
+  spans = (struct ext_crypto_span *)malloc((count ? count : 1) * sizeof(struct ext_crypto_span));
+  if (replay->base == NULL || spans == NULL)
+  {
+    fprintf(stderr, "Error decoding dtm: out of memory\n");
+    free(replay->base);
+    free(spans);
+    replay->base = NULL;
+    return -1;
+  }
+
+  header = (struct dtm_cache_header *)replay->base;
+  records = (struct dtm_record *)(header + 1);
+
+  for (i = 0; i < count; i++)
+  {
+    struct dtm_record * record = &records[i];
+    const struct report_layout * layout;
+
+    len = dtm_next_record(movie, &report);
+    record->len = len;
+    memcpy(record->report, report, len);
+
+    layout = (len >= 2) ? report_get_layout(report[1]) : NULL;
+    if (layout != NULL && layout->extension >= 0 &&
+      2 + layout->extension + layout->extension_length <= len)
+    {
+      record->extension = 2 + layout->extension;
+      record->extension_length = layout->extension_length;
+
+      //extension bytes in data reports are read from register 0x08 onwards
+      spans[span_count].buffer = record->report + record->extension;
+      spans[span_count].addr_offset = 0x08;
+      spans[span_count].length = record->extension_length;
+      span_count++;
+    }
+  }
+
+  ext_decrypt_spans((struct ext_crypto_state *)movie->key, spans, span_count);
+  free(spans);
+
+  header->magic = DTM_CACHE_MAGIC;
+  header->version = DTM_CACHE_VERSION;
+  header->source_size = movie->size;
+  header->source_mtime = movie->mtime;
+  memcpy(header->key, movie->key, 16);
+  header->frame_count = movie->frame_count;
+  header->record_count = count;
+
+  replay->mapped = false;
+  replay->records = records;
+  replay->count = count;
+  replay->frame_count = movie->frame_count;
+
+  //written aside and renamed, so a half written cache is never picked up
+  char tmp_path[PATH_MAX];
+  snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", cache_path);
+
+  FILE * out = fopen(tmp_path, "wb");
+  if (out == NULL)
+  {
+    fprintf(stderr, "Unable to save dtm cache '%s': %s\n", cache_path, strerror(errno));
+    return 0;
+  }
+
+  if (fwrite(replay->base, replay->size, 1, out) != 1 || fclose(out) != 0 ||
+    rename(tmp_path, cache_path) < 0)
+  {
+    fprintf(stderr, "Unable to save dtm cache '%s': %s\n", cache_path, strerror(errno));
+    unlink(tmp_path);
+  }
+
+  return 0;
+}
+
+int dtm_replay_open(struct dtm_replay * replay, const char * path, const char * key_path, bool build)
+{
+  struct dtm_movie movie;
+  char cache_path[PATH_MAX];
+  int result = 0;
+
+  memset(replay, 0, sizeof(struct dtm_replay));
+
+  if (dtm_open(&movie, path, key_path))
+  {
+    return -1;
+  }
+
+  snprintf(cache_path, sizeof(cache_path), "%s%s", path, DTM_CACHE_SUFFIX);
+
+  if (map_cache(replay, cache_path, &movie) < 0)
+  {
+    if (build)
+    {
+      printf("decoding dtm '%s'\n", path);
+      result = build_cache(replay, cache_path, &movie);
+    }
+    else
+    {
+      fprintf(stderr, "dtm '%s' has no cache for this movie and key\n", path);
+      result = -1;
+    }
+  }
+
+  dtm_close(&movie);
+  return result;
+}
+
+void dtm_replay_close(struct dtm_replay * replay)
+{
+  if (replay->base != NULL)
+  {
+    if (replay->mapped)
+    {
+      munmap(replay->base, replay->size);
+    }
+    else
+    {
+      free(replay->base);
+    }
+    replay->base = NULL;
+  }
+}
+
+int dtm_replay_seek_report(struct dtm_replay * replay, uint32_t report)
+{
+  if (report >= replay->count)
+  {
+    return -1;
+  }
+
+  replay->cursor = report;
+  return 0;
+}
+
+int dtm_replay_seek_frame(struct dtm_replay * replay, uint32_t frame)
+{
+  if (replay->frame_count == 0 || frame >= replay->frame_count)
+  {
+    return -1;
+  }
+
+  //first record of the frame
+  return dtm_replay_seek_report(replay,
+    ((uint64_t)frame * replay->count + replay->frame_count - 1) / replay->frame_count);
+}
+
+int dtm_playlist_add(const char * path, const char * key_path, bool build)
+{
+  struct dtm_playlist_entry * entry;
+  struct dtm_replay replay;
+
+  if (dtm_replay_open(&replay, path, key_path, build))
+  {
+    return -1;
+  }
+
+  //fault the whole movie in now rather than when it starts playing
+  if (replay.mapped)
+  {
+    madvise(replay.base, replay.size, MADV_WILLNEED);
+  }
+
+  pthread_mutex_lock(&playlist_lock);
+  if (playlist_count == DTM_PLAYLIST_SIZE)
+  {
+    pthread_mutex_unlock(&playlist_lock);
+    fprintf(stderr, "Can't queue dtm '%s': playlist full\n", path);
+    dtm_replay_close(&replay);
+    return -1;
+  }
+
+  entry = &playlist[(playlist_head + playlist_count) % DTM_PLAYLIST_SIZE];
+  entry->replay = replay;
+  snprintf(entry->path, sizeof(entry->path), "%s", path);
+  entry->state = DTM_ENTRY_READY;
+  entry->generation = playlist_generation;
+  playlist_count++;
+  pthread_mutex_unlock(&playlist_lock);
+
+  printf("queued dtm '%s', %u reports\n", path, replay.count);
+  return 0;
+}
+
+//decodes queued movies one at a time, in playlist order
+static void * playlist_decoder(void * arg)
+{
+  struct dtm_playlist_entry * entry;
+  struct dtm_replay replay;
+  char path[PATH_MAX], key_path[PATH_MAX];
+  uint32_t generation;
+  uint64_t one = 1;
+  int i, result;
+
+  pthread_mutex_lock(&playlist_lock);
+  while (true)
+  {
+    entry = NULL;
+    for (i = 0; i < playlist_count; i++)
+    {
+      if (playlist[(playlist_head + i) % DTM_PLAYLIST_SIZE].state == DTM_ENTRY_QUEUED)
+      {
+        entry = &playlist[(playlist_head + i) % DTM_PLAYLIST_SIZE];
+        break;
+      }
+    }
+
+    if (entry == NULL)
+    {
+      pthread_cond_wait(&playlist_queued, &playlist_lock);
+      continue;
+    }
+
+    entry->state = DTM_ENTRY_DECODING;
+    generation = entry->generation;
+    memcpy(path, entry->path, sizeof(path));
+    memcpy(key_path, entry->key_path, sizeof(key_path));
+    pthread_mutex_unlock(&playlist_lock);
+
+    result = dtm_replay_open(&replay, path, key_path, true);
+    if (result == 0 && replay.mapped)
+    {
+      madvise(replay.base, replay.size, MADV_WILLNEED);
+    }
+
+    pthread_mutex_lock(&playlist_lock);
+    //a clear while decoding frees the entry, it may even be queued again
+    if (entry->state != DTM_ENTRY_DECODING || entry->generation != generation)
+    {
+      if (result == 0) dtm_replay_close(&replay);
+      continue;
+    }
+
+    if (result == 0)
+    {
+      entry->replay = replay;
+      entry->state = DTM_ENTRY_READY;
+      printf("dtm '%s' ready, %u reports\n", path, replay.count);
+    }
+    else
+    {
+      entry->state = DTM_ENTRY_FAILED;
+    }
+
+    if (write(playlist_fd, &one, sizeof(one)) < 0)
+    {
+      fprintf(stderr, "Unable to signal decoded dtm: %s\n", strerror(errno));
+    }
+  }
+
+  return NULL;
+}
+
+int dtm_playlist_init(void)
+{
+  pthread_t thread;
+
+  playlist_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (playlist_fd < 0)
+  {
+    fprintf(stderr, "Unable to create dtm eventfd: %s\n", strerror(errno));
+    return -1;
+  }
+
+  //never joined, a decode cut short at exit leaves no cache behind as it's
+  //only renamed into place once written
+  if (pthread_create(&thread, NULL, playlist_decoder, NULL) != 0)
+  {
+    fprintf(stderr, "Unable to start dtm decode thread\n");
+    close(playlist_fd);
+    playlist_fd = -1;
+    return -1;
+  }
+  pthread_detach(thread);
+
+  return playlist_fd;
+}
+
+int dtm_playlist_queue(const char * path, const char * key_path)
+{
+  struct dtm_playlist_entry * entry;
+
+  pthread_mutex_lock(&playlist_lock);
+  if (playlist_count == DTM_PLAYLIST_SIZE)
+  {
+    pthread_mutex_unlock(&playlist_lock);
+    fprintf(stderr, "Can't queue dtm '%s': playlist full\n", path);
+    return -1;
+  }
+
+  entry = &playlist[(playlist_head + playlist_count) % DTM_PLAYLIST_SIZE];
+  memset(&entry->replay, 0, sizeof(entry->replay));
+  snprintf(entry->path, sizeof(entry->path), "%s", path);
+  snprintf(entry->key_path, sizeof(entry->key_path), "%s", key_path);
+  entry->state = DTM_ENTRY_QUEUED;
+  entry->generation = playlist_generation;
+  playlist_count++;
+
+  pthread_cond_signal(&playlist_queued);
+  pthread_mutex_unlock(&playlist_lock);
+
+  printf("queued dtm '%s'\n", path);
+  return 0;
+}
+
+void dtm_playlist_loaded(void)
+{
+  uint64_t count;
+
+  while (read(playlist_fd, &count, sizeof(count)) == sizeof(count));
+}
+
+void dtm_playlist_clear(void)
+{
+  pthread_mutex_lock(&playlist_lock);
+  while (playlist_count > 0)
+  {
+    //an entry being decoded is left to the decode thread to close
+    if (playlist[playlist_head].state == DTM_ENTRY_READY)
+    {
+      dtm_replay_close(&playlist[playlist_head].replay);
+    }
+    playlist[playlist_head].state = DTM_ENTRY_FAILED;
+    playlist_head = (playlist_head + 1) % DTM_PLAYLIST_SIZE;
+    playlist_count--;
+  }
+  playlist_generation++;
+  pthread_mutex_unlock(&playlist_lock);
+}
+
+int dtm_playlist_start(void)
+{
+  if (playlist_count == 0 && dtm_playlist_queue(DEFAULT_TAS, DEFAULT_KEY))
+  {
+    return -1;
+  }
+
+  printf("playing dtm '%s'\n", playlist[playlist_head].path);
+  return 0;
+}
+
+//the movie seeks apply to, NULL if there isn't one ready
+static struct dtm_replay * current_replay(void)
+{
+  bool ready;
+
+  //decoding here would stall the reports, tas.dtm can be seeked once it has
+  //a cache, otherwise playback has to be started or the movie queued first
+  if (playlist_count == 0 && dtm_playlist_add(DEFAULT_TAS, DEFAULT_KEY, false))
+  {
+    fprintf(stderr, "Can't seek dtm: nothing decoded to seek in\n");
+    return NULL;
+  }
+
+  pthread_mutex_lock(&playlist_lock);
+  ready = (playlist[playlist_head].state == DTM_ENTRY_READY);
+  pthread_mutex_unlock(&playlist_lock);
+
+  //once ready, only the event loop touches it
+  if (!ready)
+  {
+    fprintf(stderr, "Can't seek dtm: '%s' isn't decoded yet\n", playlist[playlist_head].path);
+    return NULL;
+  }
+  return &playlist[playlist_head].replay;
+}
+
+//the record seeked to is what the host gets next, so it's what has to fit
+//the reporting mode and extension the host set up
+static int seek_result(struct wiimote_state * state, const struct dtm_replay * replay,
+  int result, const char * what, uint32_t n)
+{
+  const struct dtm_record * record;
+
+  if (result < 0)
+  {
+    fprintf(stderr, "Can't seek dtm to %s %u: out of range\n", what, n);
+    return -1;
+  }
+
+  record = &replay->records[replay->cursor];
+  printf("dtm at report %u of %u, reporting mode 0x%02x\n", replay->cursor, replay->count,
+    record->report[1]);
+
+  if (state->sys.reporting_mode != record->report[1])
+  {
+    printf("warning: host has reporting mode 0x%02x set up\n", state->sys.reporting_mode);
+  }
+  if (record->extension_length && state->sys.connected_extension_type == NoExtension)
+  {
+    printf("warning: movie reports extension bytes but no extension is connected\n");
+  }
+  return 0;
+}
+
+int seek_dtm_report(struct wiimote_state * state, uint32_t report)
+{
+  struct dtm_replay * replay = current_replay();
+
+  if (replay == NULL)
+  {
+    return -1;
+  }
+
+  return seek_result(state, replay, dtm_replay_seek_report(replay, report), "report", report);
+}
+
+int seek_dtm_frame(struct wiimote_state * state, uint32_t frame)
+{
+  struct dtm_replay * replay = current_replay();
+
+  if (replay == NULL)
+  {
+    return -1;
+  }
+
+  return seek_result(state, replay, dtm_replay_seek_frame(replay, frame), "frame", frame);
+}
+
+// returns the length of buf
+int next_dtm_report(struct wiimote_state *state, uint8_t *buf)
+{
+  struct dtm_playlist_entry *entry;
+  struct dtm_replay *replay;
+  const struct dtm_record *record;
+  int len;
+
+  pthread_mutex_lock(&playlist_lock);
+
+  //the next movie takes over in the same call, so there's no gap
+  while (playlist_count > 0 &&
+    (playlist[playlist_head].state == DTM_ENTRY_FAILED ||
+    (playlist[playlist_head].state == DTM_ENTRY_READY &&
+    playlist[playlist_head].replay.cursor >= playlist[playlist_head].replay.count)))
+  {
+    if (playlist[playlist_head].state == DTM_ENTRY_READY)
+    {
+      dtm_replay_close(&playlist[playlist_head].replay);
+    }
+    playlist_head = (playlist_head + 1) % DTM_PLAYLIST_SIZE;
+    playlist_count--;
+
+    if (playlist_count > 0)
+    {
+      printf("playing dtm '%s'\n", playlist[playlist_head].path);
+    }
+  }
+
+  if (playlist_count == 0)
+  {
+    pthread_mutex_unlock(&playlist_lock);
+    return 0;
+  }
+
+  entry = &playlist[playlist_head];
+  if (entry->state != DTM_ENTRY_READY)
+  {
+    pthread_mutex_unlock(&playlist_lock);
+    return -1;
+  }
+
+  replay = &entry->replay;
+  record = &replay->records[replay->cursor++];
+  memcpy(buf, record->report, record->len);
+  len = record->len;
+
+  //the cache holds plaintext, only the session encryption is left
+  if (record->extension_length && state->sys.extension_encrypted)
+  {
+    ext_encrypt_bytes(&state->sys.extension_crypto_state, buf + record->extension, 0x08,
+      record->extension_length);
+  }
+
+  pthread_mutex_unlock(&playlist_lock);
+  return len;
 }
@@ -3,13 +3,127 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stddef.h>
+#include <stdbool.h>
 #include "wiimote.h"
 #include "wm_crypto.h"
 
-const char *DEFAULT_TAS = "./tas.dtm";
-const char *DEFAULT_KEY = "./taskey.txt";
+#define DEFAULT_TAS "./tas.dtm"
+#define DEFAULT_KEY "./taskey.txt"
 
-// returns 0 on error or input sequence end
+//reports start after the fixed size header
+#define DTM_HEADER_SIZE 0x100
+//little endian u64 in the header, vi count of the whole movie
+#define DTM_HEADER_FRAME_COUNT 0x0d
+//the rest of the header is only written, by cap2dtm
+#define DTM_SIGNATURE "DTM\x1a"
+#define DTM_HEADER_IS_WII 0x0a
+#define DTM_HEADER_CONTROLLERS 0x0b //bits 0-3 gamecube pads, 4-7 wiimotes
+#define DTM_HEADER_INPUT_COUNT 0x15 //little endian u64
+
+//a dtm file mapped whole, reports are read straight out of the mapping
+struct dtm_movie
+{
+  const uint8_t * data; //NULL when closed
+  size_t size;
+  size_t cursor; //offset of the next report record
+  int64_t mtime; //ns
+  uint64_t frame_count; //from the header, 0 if unknown
+  uint8_t key[16]; //extension key the movie was recorded with
+};
+
+//decoded movies are cached next to the .dtm as <path>.cache: a header then
+//fixed size records holding each report with its extension bytes already
+//decrypted, so playback only has to encrypt them. the records being fixed
+//size is also the index, report n is records[n]
+#define DTM_CACHE_SUFFIX ".cache"
+#define DTM_CACHE_MAGIC 0x43444d57 //"WMDC"
+#define DTM_CACHE_VERSION 3
+
+struct dtm_cache_header
+{
+  uint32_t magic;
+  uint32_t version;
+  //the cache is rebuilt if the movie or its key change
+  uint64_t source_size;
+  int64_t source_mtime; //ns
+  uint8_t key[16];
+  uint64_t frame_count;
+  uint32_t record_count;
+  uint32_t reserved;
+};
+
+//largest report a record can hold
+#define DTM_RECORD_REPORT_SIZE 29
+
+struct dtm_record
+{
+  uint8_t len;
+  uint8_t extension; //offset of the extension bytes in report
+  uint8_t extension_length; //0 if the report has none
+  uint8_t report[DTM_RECORD_REPORT_SIZE]; //0xa1 io byte first
+};
+
+struct dtm_replay
+{
+  void * base; //header then records, NULL when closed
+  size_t size;
+  bool mapped; //base is the mapped cache file rather than a fresh build
+
+  const struct dtm_record * records;
+  uint32_t count;
+  uint32_t cursor; //next record to play
+  uint64_t frame_count;
+};
+
+// returns 0 on success
+int dtm_open(struct dtm_movie * movie, const char * path, const char * key_path);
+void dtm_close(struct dtm_movie * movie);
+
+// points report at the next report record, still encrypted with the movie
+// key, and returns its length. returns 0 at the end of the movie
+int dtm_next_record(struct dtm_movie * movie, const uint8_t ** report);
+
+// opens the decoded cache for a movie. if it's missing or stale it's built
+// first when build is set, which reads the whole movie, otherwise it fails
+// returns 0 on success
+int dtm_replay_open(struct dtm_replay * replay, const char * path, const char * key_path, bool build);
+void dtm_replay_close(struct dtm_replay * replay);
+
+// move the replay to a record or frame number. the movie doesn't mark frames,
+// so they're spread evenly over the records. returns 0 on success, -1 if
+// it's past the end of the movie
+int dtm_replay_seek_report(struct dtm_replay * replay, uint32_t report);
+int dtm_replay_seek_frame(struct dtm_replay * replay, uint32_t frame);
+
+// seek the movie next_dtm_report is playing, warning if the movie there
+// doesn't match the reporting mode or extension state has set up
+// returns 0 on success
+int seek_dtm_report(struct wiimote_state * state, uint32_t report);
+int seek_dtm_frame(struct wiimote_state * state, uint32_t frame);
+
+//movies that can be queued up for back to back playback
+#define DTM_PLAYLIST_SIZE 16
+
+// starts the thread that decodes movies for dtm_playlist_queue. returns an
+// eventfd that's readable whenever one is ready, -1 on error
+int dtm_playlist_init(void);
+// call when that fd is readable
+void dtm_playlist_loaded(void);
+
+// opens the movie and queues it after the others, build as for
+// dtm_replay_open. returns 0 on success
+int dtm_playlist_add(const char * path, const char * key_path, bool build);
+// queues the movie after the others right away and leaves opening it, and
+// decoding it if need be, to the decode thread. returns 0 on success
+int dtm_playlist_queue(const char * path, const char * key_path);
+void dtm_playlist_clear(void);
+// queues DEFAULT_TAS if nothing else is. returns 0 if there's a movie to play
+int dtm_playlist_start(void);
+
+// plays the playlist, moving on to the next movie as each one ends
+// returns 0 on error or input sequence end, -1 while the movie it's up to
+// is still being decoded
 int next_dtm_report(struct wiimote_state * state, uint8_t *buf);
 
-#endif // _DTM_READER_H
\ No newline at end of file
+#endif // _DTM_READER_H
@@ -0,0 +1,124 @@
+#include "eeprom.h"
+#include "wm_time.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+int eeprom_open(struct eeprom * eeprom, const char * path)
+{
+  struct stat st;
+  void * data;
+
+  memset(eeprom, 0, sizeof(struct eeprom));
+
+  eeprom->fd = open(path, O_RDWR);
+  if (eeprom->fd >= 0)
+  {
+    eeprom->writable = true;
+  }
+  else
+  {
+    //fall back to a private copy, writes only last until shutdown
+    eeprom->fd = open(path, O_RDONLY);
+    if (eeprom->fd < 0)
+    {
+      printf("Unable to open eeprom file %s: %s\n", path, strerror(errno));
+      return -1;
+    }
+    printf("eeprom file %s is read only, writes will not be saved\n", path);
+  }
+
+  if (fstat(eeprom->fd, &st) < 0)
+  {
+    eeprom_close(eeprom);
+    return -1;
+  }
+
+  if (st.st_size < EEPROM_SIZE)
+  {
+    //a short image would fault when mapped, so pad it out with zeros
+    if (!eeprom->writable || ftruncate(eeprom->fd, EEPROM_SIZE) < 0)
+    {
+      printf("eeprom file %s is too small\n", path);
+      eeprom_close(eeprom);
+      return -1;
+    }
+  }
+
+  data = mmap(NULL, EEPROM_SIZE, PROT_READ | PROT_WRITE,
+    eeprom->writable ? MAP_SHARED : MAP_PRIVATE, eeprom->fd, 0);
+  if (data == MAP_FAILED)
+  {
+    printf("Unable to map eeprom file %s: %s\n", path, strerror(errno));
+    eeprom_close(eeprom);
+    return -1;
+  }
+
+  eeprom->data = (uint8_t *)data;
+
+  return 0;
+}
+
+void eeprom_close(struct eeprom * eeprom)
+{
+  if (eeprom->data != NULL)
+  {
+    eeprom_flush(eeprom, true);
+    munmap(eeprom->data, EEPROM_SIZE);
+    eeprom->data = NULL;
+  }
+
+  if (eeprom->fd >= 0)
+  {
+    close(eeprom->fd);
+    eeprom->fd = -1;
+  }
+}
+
+void eeprom_write(struct eeprom * eeprom, uint32_t offset, const uint8_t * buf, uint32_t size)
+{
+  if (eeprom->data == NULL || size == 0) return;
+
+  memcpy(eeprom->data + offset, buf, size);
+
+  if (!eeprom->writable) return;
+
+  //grow the dirty range, the first write starts the flush timer
+  if (eeprom->dirty_start == eeprom->dirty_end)
+  {
+    eeprom->dirty_start = offset;
+    eeprom->dirty_end = offset + size;
+    eeprom->flush_deadline = wm_time_us() + EEPROM_FLUSH_INTERVAL_US;
+  }
+  else
+  {
+    if (offset < eeprom->dirty_start) eeprom->dirty_start = offset;
+    if (offset + size > eeprom->dirty_end) eeprom->dirty_end = offset + size;
+  }
+}
+
+void eeprom_flush(struct eeprom * eeprom, bool force)
+{
+  uint32_t page_mask, start;
+
+  if (eeprom->dirty_start == eeprom->dirty_end) return; //nothing written
+
+  if (!force && wm_time_us() < eeprom->flush_deadline) return;
+
+  //msync needs a page aligned start address
+  page_mask = ~((uint32_t)sysconf(_SC_PAGESIZE) - 1);
+  start = eeprom->dirty_start & page_mask;
+
+  if (msync(eeprom->data + start, eeprom->dirty_end - start, force ? MS_SYNC : MS_ASYNC) < 0)
+  {
+    printf("Unable to sync eeprom file: %s\n", strerror(errno));
+  }
+
+  eeprom->dirty_start = 0;
+  eeprom->dirty_end = 0;
+}
@@ -0,0 +1,31 @@
+#ifndef EEPROM_H
+#define EEPROM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//size of the eeprom image, addresses past the end cannot be read or written
+#define EEPROM_SIZE 0x1700
+
+//how long written bytes may stay in memory before being synced to the file
+#define EEPROM_FLUSH_INTERVAL_US 2000000
+
+struct eeprom
+{
+  uint8_t * data; //mapped image, NULL if the file couldn't be opened
+  int fd;
+  bool writable; //false if mapped privately, writes are not persisted
+
+  //byte range written since the last flush, empty when start == end
+  uint32_t dirty_start;
+  uint32_t dirty_end;
+  uint64_t flush_deadline;
+};
+
+int eeprom_open(struct eeprom * eeprom, const char * path);
+void eeprom_close(struct eeprom * eeprom);
+
+void eeprom_write(struct eeprom * eeprom, uint32_t offset, const uint8_t * buf, uint32_t size);
+void eeprom_flush(struct eeprom * eeprom, bool force);
+
+#endif
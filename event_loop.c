@@ -0,0 +1,121 @@
+#include "event_loop.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+int event_loop_init(struct event_loop * loop)
+{
+  int i;
+
+  for (i = 0; i < EVENT_LOOP_MAX_WATCHES; i++)
+  {
+    loop->watches[i].fd = -1;
+    loop->watches[i].generation = 0;
+  }
+
+  loop->epfd = epoll_create1(EPOLL_CLOEXEC);
+  if (loop->epfd < 0)
+  {
+    printf("Unable to create epoll instance: %s\n", strerror(errno));
+    return -1;
+  }
+
+  return 0;
+}
+
+void event_loop_close(struct event_loop * loop)
+{
+  if (loop->epfd >= 0)
+  {
+    close(loop->epfd);
+    loop->epfd = -1;
+  }
+}
+
+int event_loop_add(struct event_loop * loop, int fd, uint32_t events, event_handler handler, void * data)
+{
+  struct epoll_event ev;
+  struct event_watch * watch = NULL;
+  int i;
+
+  for (i = 0; i < EVENT_LOOP_MAX_WATCHES; i++)
+  {
+    if (loop->watches[i].fd < 0)
+    {
+      watch = &loop->watches[i];
+      break;
+    }
+  }
+
+  if (watch == NULL)
+  {
+    printf("too many fds in event loop, can't watch %d\n", fd);
+    return -1;
+  }
+
+  //events carry the slot and its generation, so one still queued for the
+  //slot's previous fd is told apart from events for this one
+  memset(&ev, 0, sizeof(ev));
+  ev.events = events;
+  ev.data.u64 = ((uint64_t)(watch->generation + 1) << 32) | i;
+
+  if (epoll_ctl(loop->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+  {
+    printf("Unable to watch fd %d: %s\n", fd, strerror(errno));
+    return -1;
+  }
+
+  watch->fd = fd;
+  watch->generation++;
+  watch->handler = handler;
+  watch->data = data;
+
+  return 0;
+}
+
+//must be called before the fd is closed, so a reused fd number isn't
+//dispatched to the old handler
+void event_loop_remove(struct event_loop * loop, int fd)
+{
+  int i;
+
+  if (fd < 0) return;
+
+  for (i = 0; i < EVENT_LOOP_MAX_WATCHES; i++)
+  {
+    if (loop->watches[i].fd == fd)
+    {
+      epoll_ctl(loop->epfd, EPOLL_CTL_DEL, fd, NULL);
+      loop->watches[i].fd = -1;
+      return;
+    }
+  }
+}
+
+//waits for events and runs their handlers, returns the number handled
+int event_loop_dispatch(struct event_loop * loop, int timeout_ms)
+{
+  struct epoll_event events[EVENT_LOOP_MAX_WATCHES];
+  int count, i;
+
+  count = epoll_wait(loop->epfd, events, EVENT_LOOP_MAX_WATCHES, timeout_ms);
+  if (count < 0)
+  {
+    return (errno == EINTR) ? 0 : -1;
+  }
+
+  for (i = 0; i < count; i++)
+  {
+    struct event_watch * watch = &loop->watches[(uint32_t)events[i].data.u64];
+
+    //an earlier handler in this batch may have removed it, or removed it and
+    //added another fd in its place
+    if (watch->fd < 0 || watch->generation != (uint32_t)(events[i].data.u64 >> 32)) continue;
+
+    watch->handler(watch->fd, events[i].events, watch->data);
+  }
+
+  return count;
+}
@@ -0,0 +1,36 @@
+#ifndef EVENT_LOOP_H
+#define EVENT_LOOP_H
+
+#include <stdint.h>
+#include <sys/epoll.h>
+
+//most fds that can be watched at once
+#define EVENT_LOOP_MAX_WATCHES 32
+
+//called with the epoll events that fired, edge triggered watches must
+//drain their fd before returning
+typedef void (*event_handler)(int fd, uint32_t events, void * data);
+
+struct event_watch
+{
+  int fd; //-1 if the slot is free
+  uint32_t generation; //bumped each time the slot is reused
+  event_handler handler;
+  void * data;
+};
+
+struct event_loop
+{
+  int epfd;
+  struct event_watch watches[EVENT_LOOP_MAX_WATCHES];
+};
+
+int event_loop_init(struct event_loop * loop);
+void event_loop_close(struct event_loop * loop);
+
+int event_loop_add(struct event_loop * loop, int fd, uint32_t events, event_handler handler, void * data);
+void event_loop_remove(struct event_loop * loop, int fd);
+
+int event_loop_dispatch(struct event_loop * loop, int timeout_ms);
+
+#endif
@@ -0,0 +1,308 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/socket.h>
+
+#include "wiimote.h"
+#include "wm_time.h"
+#include "transport.h"
+
+//plays the host side of a wii connecting to a wiimote with a nunchuk
+//behind motion plus, and times each phase until 0x37 reports arrive
+
+//how long a step may wait for its replies in total before giving up
+#define REPLY_TIMEOUT_MS 1000
+//generate_report calls that may return nothing before an in-process reply times out
+#define REPLY_TIMEOUT_REPORTS 1000
+
+//address the fake wii connects from over loopback
+static const char * loopback_wii = "00:00:00:00:00:10";
+
+struct fakewii_step
+{
+  uint8_t report[23]; //output report, 0xa2 io byte first
+  uint8_t len;
+  uint8_t reply_type; //input report that answers it
+  uint8_t reply_count;
+};
+
+struct fakewii_phase
+{
+  const char * name;
+  const struct fakewii_step * steps;
+  int step_count;
+
+  //per run timings, in us
+  uint64_t sum;
+  uint64_t min;
+  uint64_t max;
+};
+
+#define WRITE_REG(addr, size, ...) \
+  { { 0xa2, 0x16, 0x04, (addr) >> 16, ((addr) >> 8) & 0xff, (addr) & 0xff, (size), __VA_ARGS__ }, 23, 0x22, 1 }
+#define READ_REG(addr, size) \
+  { { 0xa2, 0x17, 0x04, (addr) >> 16, ((addr) >> 8) & 0xff, (addr) & 0xff, 0x00, (size) }, 8, 0x21, 1 }
+
+static const struct fakewii_step status_steps[] = {
+  { { 0xa2, 0x15, 0x00 }, 3, 0x20, 1 },
+};
+
+static const struct fakewii_step led_steps[] = {
+  { { 0xa2, 0x11, 0x10 }, 3, 0x22, 1 },
+};
+
+static const struct fakewii_step extension_id_steps[] = {
+  WRITE_REG(0xa400f0, 1, 0x55),
+  WRITE_REG(0xa400fb, 1, 0x00),
+  READ_REG(0xa400fa, 6),
+};
+
+static const struct fakewii_step key_steps[] = {
+  WRITE_REG(0xa40040, 6, 0x2f, 0x9a, 0x31, 0x4c, 0x07, 0xd5),
+  WRITE_REG(0xa40046, 6, 0x6e, 0x18, 0xb2, 0x90, 0x5a, 0x43),
+  WRITE_REG(0xa4004c, 4, 0xc1, 0x7d, 0x26, 0xe8),
+};
+
+static const struct fakewii_step motionplus_steps[] = {
+  READ_REG(0xa600fa, 6),
+  //ack, then the extension is reported unplugged and plugged back in
+  { { 0xa2, 0x16, 0x04, 0xa6, 0x00, 0xfe, 1, 0x05 }, 23, 0x22, 1 },
+  { { 0 }, 0, 0x20, 2 },
+};
+
+static const struct fakewii_step mode_steps[] = {
+  { { 0xa2, 0x12, 0x04, 0x37 }, 4, 0x22, 1 },
+  { { 0 }, 0, 0x37, 1 }, //first data report
+};
+
+#define PHASE(name, steps) { name, steps, sizeof(steps) / sizeof(steps[0]), 0, UINT64_MAX, 0 }
+
+static struct fakewii_phase phases[] = {
+  PHASE("status", status_steps),
+  PHASE("leds", led_steps),
+  PHASE("extension id", extension_id_steps),
+  PHASE("encryption key", key_steps),
+  PHASE("motion plus", motionplus_steps),
+  PHASE("reporting 0x37", mode_steps),
+};
+
+#define PHASE_COUNT (sizeof(phases) / sizeof(phases[0]))
+
+//either an in-process wiimote or an emulator over the loopback transport
+static struct wiimote_state state;
+static int int_fd = -1;
+
+static int send_report(const uint8_t * buf, int len)
+{
+  if (int_fd < 0)
+  {
+    return process_report(&state, buf, len);
+  }
+
+  return (send(int_fd, buf, len, 0) == len) ? 0 : -1;
+}
+
+//returns the length of the next input report, 0 on timeout
+static int recv_report(uint8_t * buf, int timeout_ms)
+{
+  int len, i;
+
+  if (int_fd < 0)
+  {
+    for (i = 0; i < REPLY_TIMEOUT_REPORTS; i++)
+    {
+      len = generate_report(&state, buf);
+      if (len > 0) return len;
+    }
+    return 0;
+  }
+
+  struct pollfd pfd = { .fd = int_fd, .events = POLLIN };
+  if (poll(&pfd, 1, timeout_ms) <= 0)
+  {
+    return 0;
+  }
+
+  len = recv(int_fd, buf, 32, 0);
+  return (len > 0) ? len : 0;
+}
+
+static int run_step(const struct fakewii_step * step)
+{
+  uint8_t buf[32];
+  int len, replies = 0;
+  //other reports keep arriving, so the deadline covers the whole step
+  uint64_t deadline = wm_time_us() + REPLY_TIMEOUT_MS * 1000;
+  uint64_t now;
+
+  if (step->len > 0 && send_report(step->report, step->len) < 0)
+  {
+    printf("failed to send report %02x\n", step->report[1]);
+    return -1;
+  }
+
+  while (replies < step->reply_count)
+  {
+    now = wm_time_us();
+    len = (now < deadline) ? recv_report(buf, (deadline - now + 999) / 1000) : 0;
+    if (len == 0)
+    {
+      printf("timed out waiting for report %02x\n", step->reply_type);
+      return -1;
+    }
+
+    if (buf[1] != step->reply_type) continue; //data reports and such
+
+    //acks name the report they answer
+    if (step->reply_type == 0x22 && len > 4 && buf[4] != step->report[1]) continue;
+
+    replies++;
+  }
+
+  return 0;
+}
+
+static int run_handshake()
+{
+  unsigned int i;
+  int j;
+  uint64_t start, elapsed;
+
+  for (i = 0; i < PHASE_COUNT; i++)
+  {
+    start = wm_time_us();
+
+    for (j = 0; j < phases[i].step_count; j++)
+    {
+      if (run_step(&phases[i].steps[j]) < 0)
+      {
+        printf("handshake failed in phase '%s'\n", phases[i].name);
+        return -1;
+      }
+    }
+
+    elapsed = wm_time_us() - start;
+    phases[i].sum += elapsed;
+    if (elapsed < phases[i].min) phases[i].min = elapsed;
+    if (elapsed > phases[i].max) phases[i].max = elapsed;
+  }
+
+  return 0;
+}
+
+//a fresh wiimote with a nunchuk already plugged in
+static void init_local_wiimote()
+{
+  uint8_t buf[32];
+
+  wiimote_init(&state);
+  state.usr.connected_extension_type = Nunchuk;
+
+  //the first report plugs the nunchuk in, drop everything queued so far
+  do
+  {
+    generate_report(&state, buf);
+  } while (wiimote_reply_pending(&state));
+}
+
+void print_usage(char * argv0)
+{
+  printf("usage: %s [ -n <runs> ] [ -loopback <dir> [ <wiimote-bdaddr> ] ]\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+  int runs = 100;
+  const char * loopback_dir = NULL;
+  bdaddr_t wiimote_bdaddr = *BDADDR_ANY;
+  bdaddr_t wii_bdaddr;
+  uint64_t total = 0;
+  unsigned int i;
+  int run;
+
+  for (run = 1; run < argc; run++)
+  {
+    if (strcmp(argv[run], "-n") == 0 && run + 1 < argc)
+    {
+      runs = atoi(argv[++run]);
+    }
+    else if (strcmp(argv[run], "-loopback") == 0 && run + 1 < argc)
+    {
+      loopback_dir = argv[++run];
+      if (run + 1 < argc && bachk(argv[run + 1]) >= 0)
+      {
+        str2ba(argv[++run], &wiimote_bdaddr);
+      }
+    }
+    else
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (runs <= 0)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (loopback_dir != NULL)
+  {
+    //the emulator keeps its state between runs, so only one makes sense
+    runs = 1;
+
+    if (transport_loopback_init(loopback_dir) < 0)
+    {
+      return 1;
+    }
+
+    str2ba(loopback_wii, &wii_bdaddr);
+
+    int ctrl_fd = transport_loopback.connect(&wii_bdaddr, &wiimote_bdaddr, PSM_CTRL);
+    int_fd = transport_loopback.connect(&wii_bdaddr, &wiimote_bdaddr, PSM_INT);
+    if (ctrl_fd < 0 || int_fd < 0)
+    {
+      printf("can't connect to emulator: %s\n", strerror(errno));
+      return 1;
+    }
+
+    if (run_handshake() < 0)
+    {
+      return 1;
+    }
+
+    close(int_fd);
+    close(ctrl_fd);
+  }
+  else
+  {
+    for (run = 0; run < runs; run++)
+    {
+      init_local_wiimote();
+
+      if (run_handshake() < 0)
+      {
+        wiimote_destroy(&state);
+        return 1;
+      }
+
+      wiimote_destroy(&state);
+    }
+  }
+
+  printf("%-16s %10s %10s %10s\n", "phase", "mean us", "min us", "max us");
+  for (i = 0; i < PHASE_COUNT; i++)
+  {
+    printf("%-16s %10.1f %10llu %10llu\n", phases[i].name,
+      (double)phases[i].sum / runs,
+      (unsigned long long)phases[i].min, (unsigned long long)phases[i].max);
+    total += phases[i].sum;
+  }
+  printf("%-16s %10.1f\n", "handshake", (double)total / runs);
+
+  return 0;
+}
@@ -3,6 +3,7 @@
 #include "SDL/SDL.h"
 #include <math.h>
 #include "motion.h"
+#include "dtm_reader.h"
 
 int ir_up, ir_down, ir_left, ir_right,
     steer_left, steer_right,
@@ -10,6 +11,9 @@ int ir_up, ir_down, ir_left, ir_right,
     classic_left_stick_up, classic_left_stick_down, classic_left_stick_left, classic_left_stick_right,
     motionplus_up, motionplus_down, motionplus_left, motionplus_right, motionplus_slow;
 extern int show_reports;
+extern unsigned int playback_speed_request;
+extern int playback_seek;
+extern bool playback_seek_frame;
 
 static const double pointer_margin = 0.5;
 float pointer_x = 0.5;
@@ -18,6 +22,7 @@ float pointer_y = 0.5;
 int input_update(struct wiimote_state *state, struct input_source const * source)
 {
   struct input_event event;
+  struct wiimote_state_usr before = state->usr;
 
   float pointer_delta_x = 0, pointer_delta_y = 0;
 
@@ -38,7 +43,26 @@ int input_update(struct wiimote_state *state, struct input_source const * source
         show_reports = (show_reports + 1) % 2;
         break;
       case INPUT_EMULATOR_PLAYBACK_TAS:
+        wiimote_mark_dirty(state, &before, REPORT_DIRTY_ALL);
         return -3;
+      case INPUT_EMULATOR_PLAYBACK_SPEED:
+        playback_speed_request = event.emulator_control_event.value;
+        wiimote_mark_dirty(state, &before, REPORT_DIRTY_ALL);
+        return -4;
+      case INPUT_EMULATOR_PLAYBACK_SEEK_REPORT:
+      case INPUT_EMULATOR_PLAYBACK_SEEK_FRAME:
+        playback_seek = event.emulator_control_event.value;
+        playback_seek_frame = (event.emulator_control_event.control == INPUT_EMULATOR_PLAYBACK_SEEK_FRAME);
+        wiimote_mark_dirty(state, &before, REPORT_DIRTY_ALL);
+        return -5;
+      case INPUT_EMULATOR_PLAYBACK_QUEUE:
+        //decoded on the decode thread, reports carry on meanwhile
+        dtm_playlist_queue(event.emulator_control_event.path,
+          event.emulator_control_event.key_path ? event.emulator_control_event.key_path : DEFAULT_KEY);
+        break;
+      case INPUT_EMULATOR_PLAYBACK_CLEAR:
+        dtm_playlist_clear();
+        break;
       }
       break;
     case INPUT_EVENT_TYPE_HOTPLUG:
@@ -257,5 +281,7 @@ int input_update(struct wiimote_state *state, struct input_source const * source
   state->usr.motionplus.pitch_slow = motionplus_slow;
   state->usr.motionplus.yaw_slow = motionplus_slow;
 
+  wiimote_mark_dirty(state, &before, REPORT_DIRTY_ALL);
+
   return 0;
 }
@@ -20,11 +20,19 @@ enum input_emulator_control
     INPUT_EMULATOR_CONTROL_POWER_OFF, // Powers off host
     INPUT_EMULATOR_PLAYBACK_TAS,
     INPUT_EMULATOR_CONTROL_TOGGLE_REPORTS,
+    INPUT_EMULATOR_PLAYBACK_SPEED, // value is the tas playback speed in percent
+    INPUT_EMULATOR_PLAYBACK_SEEK_REPORT, // value is the tas report to continue from
+    INPUT_EMULATOR_PLAYBACK_SEEK_FRAME, // value is the tas frame to continue from
+    INPUT_EMULATOR_PLAYBACK_QUEUE, // queues the tas at path, with the key at key_path
+    INPUT_EMULATOR_PLAYBACK_CLEAR, // empties the tas playlist
 };
 
 struct input_emulator_control_event
 {
     enum input_emulator_control control;
+    int value;
+    const char * path; // owned by the input source, valid until its next poll_event
+    const char * key_path; // NULL for the default key
 };
 
 struct input_hotplug_event
@@ -125,6 +133,7 @@ struct input_source
 {
     void (*unload)(void);
     bool (*poll_event)(struct input_event *event);
+    int (*get_fd)(void); // readable when events are pending, -1 if it has to be polled
 };
 
 int input_update(struct wiimote_state * state, struct input_source const * source);
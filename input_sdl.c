@@ -222,6 +222,41 @@ static bool input_sdl_poll_event(struct input_event *out_event)
         out_event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_TAS;
       }
       break;
+    case SDLK_f:
+    case SDLK_s:
+    case SDLK_n:
+      //tas playback at double, half and normal speed
+      if (!shift || event.type != SDL_KEYDOWN)
+      {
+        return false;
+      }
+
+      out_event->type = INPUT_EVENT_TYPE_EMULATOR_CONTROL;
+      out_event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_SPEED;
+      if (event.key.keysym.sym == SDLK_f)
+      {
+        out_event->emulator_control_event.value = 200;
+      }
+      else if (event.key.keysym.sym == SDLK_s)
+      {
+        out_event->emulator_control_event.value = 50;
+      }
+      else
+      {
+        out_event->emulator_control_event.value = 100;
+      }
+      break;
+    case SDLK_r:
+      //tas back to the first report
+      if (!shift || event.type != SDL_KEYDOWN)
+      {
+        return false;
+      }
+
+      out_event->type = INPUT_EVENT_TYPE_EMULATOR_CONTROL;
+      out_event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_SEEK_REPORT;
+      out_event->emulator_control_event.value = 0;
+      break;
     case SDLK_1:
       out_event->button_event.button = INPUT_BUTTON_WIIMOTE_1;
       break;
@@ -393,7 +428,14 @@ static bool input_sdl_poll_event(struct input_event *out_event)
   }
 }
 
+static int input_sdl_get_fd(void)
+{
+  //SDL 1.2 has no pollable fd, events are picked up on each report tick
+  return -1;
+}
+
 struct input_source input_source_sdl = {
   .unload = input_sdl_unload,
-  .poll_event = input_sdl_poll_event
+  .poll_event = input_sdl_poll_event,
+  .get_fd = input_sdl_get_fd
 };
\ No newline at end of file
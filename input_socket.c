@@ -138,6 +138,43 @@ static bool input_socket_poll_event(struct input_event *event)
     {
       event->emulator_control_event.control = INPUT_EMULATOR_CONTROL_POWER_OFF;
     }
+    else if (strcmp(event_param_s, "playback_speed") == 0)
+    {
+      //status is the speed in percent
+      event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_SPEED;
+      event->emulator_control_event.value = event_status;
+    }
+    else if (strcmp(event_param_s, "seek_report") == 0)
+    {
+      event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_SEEK_REPORT;
+      event->emulator_control_event.value = event_status;
+    }
+    else if (strcmp(event_param_s, "seek_frame") == 0)
+    {
+      event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_SEEK_FRAME;
+      event->emulator_control_event.value = event_status;
+    }
+    else if (strcmp(event_param_s, "queue_tas") == 0)
+    {
+      //emulator_control 0 queue_tas <movie.dtm> [<key.txt>]
+      static char path_s[256], key_path_s[256];
+      int fields = sscanf(buf, "%*s %*d %*s %255s %255s", path_s, key_path_s);
+
+      if (fields < 1)
+      {
+        printf(PROGRAM_NAME ": queue_tas needs a path\n");
+        buf_len = 0;
+        return false;
+      }
+
+      event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_QUEUE;
+      event->emulator_control_event.path = path_s;
+      event->emulator_control_event.key_path = (fields > 1) ? key_path_s : NULL;
+    }
+    else if (strcmp(event_param_s, "clear_tas") == 0)
+    {
+      event->emulator_control_event.control = INPUT_EMULATOR_PLAYBACK_CLEAR;
+    }
   }
   else if (strcmp(event_type_s, "hotplug") == 0)
   {
@@ -249,7 +286,13 @@ static bool input_socket_poll_event(struct input_event *event)
   return true;
 }
 
+static int input_socket_get_fd(void)
+{
+  return sock;
+}
+
 struct input_source input_source_socket = {
   .unload = input_socket_unload,
-  .poll_event = input_socket_poll_event
+  .poll_event = input_socket_poll_event,
+  .get_fd = input_socket_get_fd
 };
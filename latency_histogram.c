@@ -0,0 +1,103 @@
+#include "latency_histogram.h"
+
+#include <stdio.h>
+#include <string.h>
+
+static int bucket_index(uint64_t value)
+{
+  int exponent;
+
+  if (value < LATENCY_SUB_BUCKETS)
+  {
+    return value;
+  }
+
+  exponent = 63 - __builtin_clzll(value);
+
+  //the top LATENCY_SUB_BITS bits below the leading one pick the sub bucket
+  return ((exponent - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS) +
+    ((value >> (exponent - LATENCY_SUB_BITS)) & (LATENCY_SUB_BUCKETS - 1));
+}
+
+static uint64_t bucket_upper_bound(int index)
+{
+  int exponent;
+  uint64_t lower;
+
+  if (index < LATENCY_SUB_BUCKETS)
+  {
+    return index;
+  }
+
+  exponent = (index >> LATENCY_SUB_BITS) + LATENCY_SUB_BITS - 1;
+  lower = (uint64_t)(LATENCY_SUB_BUCKETS + (index & (LATENCY_SUB_BUCKETS - 1))) << (exponent - LATENCY_SUB_BITS);
+
+  return lower + ((uint64_t)1 << (exponent - LATENCY_SUB_BITS)) - 1;
+}
+
+//only the recording thread writes, so plain increments published with
+//relaxed stores are enough and never cost a locked instruction
+void latency_record(struct latency_histogram * hist, uint64_t value)
+{
+  int index = bucket_index(value);
+
+  __atomic_store_n(&hist->buckets[index], hist->buckets[index] + 1, __ATOMIC_RELAXED);
+  __atomic_store_n(&hist->sum, hist->sum + value, __ATOMIC_RELAXED);
+  if (value > hist->max)
+  {
+    __atomic_store_n(&hist->max, value, __ATOMIC_RELAXED);
+  }
+  __atomic_store_n(&hist->count, hist->count + 1, __ATOMIC_RELAXED);
+}
+
+void latency_snapshot(const struct latency_histogram * hist, struct latency_histogram * out)
+{
+  int i;
+
+  out->count = 0;
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    out->buckets[i] = __atomic_load_n(&hist->buckets[i], __ATOMIC_RELAXED);
+    out->count += out->buckets[i];
+  }
+  out->sum = __atomic_load_n(&hist->sum, __ATOMIC_RELAXED);
+  out->max = __atomic_load_n(&hist->max, __ATOMIC_RELAXED);
+}
+
+uint64_t latency_percentile(const struct latency_histogram * hist, double fraction)
+{
+  uint64_t target, seen = 0;
+  uint64_t bound;
+  int i;
+
+  if (hist->count == 0) return 0;
+
+  target = (uint64_t)(fraction * hist->count);
+  if (target >= hist->count) target = hist->count - 1;
+
+  for (i = 0; i < LATENCY_BUCKETS; i++)
+  {
+    seen += hist->buckets[i];
+    if (seen > target)
+    {
+      bound = bucket_upper_bound(i);
+      return (bound < hist->max) ? bound : hist->max;
+    }
+  }
+
+  return hist->max;
+}
+
+void latency_print(const char * name, const struct latency_histogram * hist)
+{
+  if (hist->count == 0)
+  {
+    printf("%s: no reports\n", name);
+    return;
+  }
+
+  printf("%s: %llu reports, mean %.1f us, p50 %.1f us, p99 %.1f us, p999 %.1f us, max %.1f us\n",
+    name, (unsigned long long)hist->count, (double)hist->sum / hist->count / 1000,
+    latency_percentile(hist, 0.5) / 1000.0, latency_percentile(hist, 0.99) / 1000.0,
+    latency_percentile(hist, 0.999) / 1000.0, hist->max / 1000.0);
+}
@@ -0,0 +1,34 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+
+//log bucketed latency histogram. each power of two is split into
+//2^LATENCY_SUB_BITS buckets, so a percentile is off by at most 1/8th
+#define LATENCY_SUB_BITS 3
+#define LATENCY_SUB_BUCKETS (1 << LATENCY_SUB_BITS)
+#define LATENCY_BUCKETS ((64 - LATENCY_SUB_BITS + 1) << LATENCY_SUB_BITS)
+
+//one thread records, any other may read a snapshot while it does. values
+//are whatever unit the caller uses, wmmitm records nanoseconds
+struct latency_histogram
+{
+  uint64_t count;
+  uint64_t sum;
+  uint64_t max;
+  uint64_t buckets[LATENCY_BUCKETS];
+};
+
+void latency_record(struct latency_histogram * hist, uint64_t value);
+
+//copy of the histogram, consistent enough for printing while it's recorded into
+void latency_snapshot(const struct latency_histogram * hist, struct latency_histogram * out);
+
+//upper bound of the bucket holding the given fraction (0-1) of the values
+uint64_t latency_percentile(const struct latency_histogram * hist, double fraction);
+
+//one line of count, mean, p50, p99, p999 and max, in microseconds for a
+//histogram of nanoseconds
+void latency_print(const char * name, const struct latency_histogram * hist);
+
+#endif
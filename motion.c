@@ -94,6 +94,8 @@ void set_motionplus(struct wiimote_state * state, const mat4 * wiimote_mat)
 
 void set_motion_state(struct wiimote_state * state, float pointer_x, float pointer_y)
 {
+  struct wiimote_state_usr before = state->usr;
+
   mat4 wiimote_mat;
   look_at_pointer(&wiimote_mat, pointer_x, pointer_y);
 
@@ -152,4 +154,6 @@ void set_motion_state(struct wiimote_state * state, float pointer_x, float point
   }
 
   set_accelerometer(state, &wiimote_mat);
+
+  wiimote_mark_dirty(state, &before, REPORT_DIRTY_ACCEL | REPORT_DIRTY_IR);
 }
\ No newline at end of file
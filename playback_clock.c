@@ -0,0 +1,262 @@
+#include "playback_clock.h"
+#include "wm_time.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+//when report n of the current segment is due, computed from the segment
+//start each time so rounding never accumulates
+static uint64_t report_deadline(const struct playback_clock * clock, uint64_t n)
+{
+  return clock->epoch + n * 100000000ULL / ((uint64_t)clock->rate_hz * clock->speed);
+}
+
+static void arm_timer(struct playback_clock * clock, uint64_t deadline)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  its.it_value.tv_sec = deadline / 1000000;
+  its.it_value.tv_nsec = (deadline % 1000000) * 1000;
+
+  //a deadline already in the past fires right away
+  if (its.it_value.tv_sec == 0 && its.it_value.tv_nsec == 0)
+  {
+    its.it_value.tv_nsec = 1;
+  }
+
+  timerfd_settime(clock->fd, TFD_TIMER_ABSTIME, &its, NULL);
+}
+
+static void disarm_timer(struct playback_clock * clock)
+{
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  timerfd_settime(clock->fd, 0, &its, NULL);
+}
+
+int playback_clock_init(struct playback_clock * clock, enum playback_clock_mode mode,
+  unsigned int rate_hz, unsigned int speed)
+{
+  memset(clock, 0, sizeof(struct playback_clock));
+  clock->fd = -1;
+
+  if (rate_hz == 0 || rate_hz > 1000)
+  {
+    printf("playback rate %u Hz out of range (1-1000)\n", rate_hz);
+    return -1;
+  }
+
+  if (speed < PLAYBACK_SPEED_MIN || speed > PLAYBACK_SPEED_MAX)
+  {
+    printf("playback speed %u%% out of range (%d-%d)\n", speed, PLAYBACK_SPEED_MIN, PLAYBACK_SPEED_MAX);
+    return -1;
+  }
+
+  clock->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (clock->fd < 0)
+  {
+    printf("Unable to create playback timer: %s\n", strerror(errno));
+    return -1;
+  }
+
+  clock->mode = mode;
+  clock->rate_hz = rate_hz;
+  clock->speed = speed;
+
+  return 0;
+}
+
+void playback_clock_close(struct playback_clock * clock)
+{
+  if (clock->fd >= 0)
+  {
+    close(clock->fd);
+    clock->fd = -1;
+  }
+}
+
+void playback_clock_resync(struct playback_clock * clock)
+{
+  clock->epoch = wm_time_us();
+  clock->segment_reports = 0;
+  clock->credit = 0;
+  clock->last_host = 0;
+
+  if (clock->running && clock->mode == PLAYBACK_CLOCK_FIXED)
+  {
+    arm_timer(clock, clock->epoch);
+  }
+}
+
+void playback_clock_start(struct playback_clock * clock)
+{
+  clock->running = true;
+  playback_clock_resync(clock);
+
+  //statistics are per movie
+  clock->reports = 0;
+  clock->drift_sum = 0;
+  clock->drift_sum_sq = 0;
+  clock->drift_max = 0;
+  clock->late = 0;
+  clock->host_reports = 0;
+  clock->host_interval_sum = 0;
+  clock->host_interval_max = 0;
+}
+
+void playback_clock_stop(struct playback_clock * clock)
+{
+  clock->running = false;
+  disarm_timer(clock);
+}
+
+int playback_clock_set_speed(struct playback_clock * clock, unsigned int speed)
+{
+  if (speed < PLAYBACK_SPEED_MIN || speed > PLAYBACK_SPEED_MAX)
+  {
+    printf("playback speed %u%% out of range (%d-%d)\n", speed, PLAYBACK_SPEED_MIN, PLAYBACK_SPEED_MAX);
+    return -1;
+  }
+
+  //the next report keeps the deadline it had, the new speed applies after it
+  if (clock->running && clock->mode == PLAYBACK_CLOCK_FIXED)
+  {
+    clock->epoch = report_deadline(clock, clock->segment_reports);
+    clock->segment_reports = 0;
+  }
+
+  clock->speed = speed;
+  printf("playback speed %u%%\n", speed);
+
+  if (clock->running && clock->mode == PLAYBACK_CLOCK_FIXED)
+  {
+    arm_timer(clock, clock->epoch);
+  }
+
+  return 0;
+}
+
+void playback_clock_fire(struct playback_clock * clock)
+{
+  uint64_t count;
+
+  //playback_clock_due works from the time, the count isn't needed
+  while (read(clock->fd, &count, sizeof(count)) == sizeof(count));
+}
+
+void playback_clock_host_report(struct playback_clock * clock)
+{
+  uint64_t now, interval;
+
+  if (!clock->running || clock->mode != PLAYBACK_CLOCK_HOST) return;
+
+  now = wm_time_us();
+
+  if (clock->last_host != 0)
+  {
+    interval = now - clock->last_host;
+    clock->host_reports++;
+    clock->host_interval_sum += interval;
+    if (interval > clock->host_interval_max)
+    {
+      clock->host_interval_max = interval;
+    }
+  }
+
+  clock->last_host = now;
+  clock->credit += clock->speed;
+}
+
+int playback_clock_due(struct playback_clock * clock)
+{
+  uint64_t now, n;
+
+  if (!clock->running) return 0;
+
+  if (clock->mode == PLAYBACK_CLOCK_HOST)
+  {
+    return clock->credit / 100;
+  }
+
+  now = wm_time_us();
+  if (now < report_deadline(clock, clock->segment_reports)) return 0;
+
+  //index of the last report whose deadline has passed, plus one
+  n = (now - clock->epoch) * clock->rate_hz * clock->speed / 100000000ULL + 1;
+  while (report_deadline(clock, n) <= now) n++;
+
+  return (n > clock->segment_reports) ? (int)(n - clock->segment_reports) : 1;
+}
+
+void playback_clock_sent(struct playback_clock * clock)
+{
+  uint64_t now = wm_time_us();
+  uint64_t due, drift, period;
+
+  if (clock->mode == PLAYBACK_CLOCK_HOST)
+  {
+    due = clock->last_host;
+    period = clock->host_reports ? clock->host_interval_sum / clock->host_reports : 0;
+    if (clock->credit >= 100) clock->credit -= 100;
+  }
+  else
+  {
+    due = report_deadline(clock, clock->segment_reports);
+    period = 100000000ULL / ((uint64_t)clock->rate_hz * clock->speed);
+  }
+
+  drift = (now > due) ? now - due : 0;
+
+  clock->reports++;
+  clock->drift_sum += drift;
+  clock->drift_sum_sq += drift * drift;
+  if (drift > clock->drift_max)
+  {
+    clock->drift_max = drift;
+  }
+  if (period && drift >= period)
+  {
+    clock->late++;
+  }
+
+  if (clock->mode == PLAYBACK_CLOCK_FIXED)
+  {
+    clock->segment_reports++;
+    arm_timer(clock, report_deadline(clock, clock->segment_reports));
+  }
+}
+
+void playback_clock_print_stats(const struct playback_clock * clock)
+{
+  double mean, var;
+
+  if (clock->reports == 0) return;
+
+  mean = (double)clock->drift_sum / clock->reports;
+  var = (double)clock->drift_sum_sq / clock->reports - mean * mean;
+
+  if (clock->mode == PLAYBACK_CLOCK_HOST)
+  {
+    printf("playback: host cadence, %u%% speed, %llu reports, %llu late, drift mean %.1f us, stddev %.1f us, max %llu us\n",
+      clock->speed, (unsigned long long)clock->reports, (unsigned long long)clock->late,
+      mean, sqrt(var > 0 ? var : 0), (unsigned long long)clock->drift_max);
+    if (clock->host_reports)
+    {
+      printf("playback: host interval mean %.1f us, max %llu us\n",
+        (double)clock->host_interval_sum / clock->host_reports,
+        (unsigned long long)clock->host_interval_max);
+    }
+  }
+  else
+  {
+    printf("playback: %u Hz, %u%% speed, %llu reports, %llu late, drift mean %.1f us, stddev %.1f us, max %llu us\n",
+      clock->rate_hz, clock->speed, (unsigned long long)clock->reports, (unsigned long long)clock->late,
+      mean, sqrt(var > 0 ? var : 0), (unsigned long long)clock->drift_max);
+  }
+}
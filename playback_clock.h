@@ -0,0 +1,74 @@
+#ifndef PLAYBACK_CLOCK_H
+#define PLAYBACK_CLOCK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+//dolphin updates emulated wiimotes, and so records tas inputs, at 200Hz
+#define PLAYBACK_RATE_DEFAULT 200
+
+//speed multipliers are given in percent, 100 is real time
+#define PLAYBACK_SPEED_MIN 10
+#define PLAYBACK_SPEED_MAX 1000
+
+enum playback_clock_mode
+{
+  PLAYBACK_CLOCK_FIXED, //reports go out at rate_hz
+  PLAYBACK_CLOCK_HOST, //one report per output report from the host
+};
+
+//decides when each report of a tas movie is due, either from its own timer
+//or from the host's output reports, and keeps drift statistics
+struct playback_clock
+{
+  int fd; //timerfd, readable when the next report is due (fixed mode)
+  enum playback_clock_mode mode;
+  unsigned int rate_hz;
+  unsigned int speed; //percent
+  bool running;
+
+  //report n of the current segment is due at epoch + n periods, a new
+  //segment starts whenever the speed changes
+  uint64_t epoch;
+  uint64_t segment_reports;
+
+  //host mode: speed percent owed per host report, 100 releases a report
+  uint32_t credit;
+  uint64_t last_host; //wm_time_us of the last host output report
+
+  //how late each report went out relative to when it was due
+  uint64_t reports;
+  uint64_t drift_sum;
+  uint64_t drift_sum_sq;
+  uint64_t drift_max;
+  uint64_t late; //reports sent a whole period or more after they were due
+
+  //host mode: time between host output reports
+  uint64_t host_reports;
+  uint64_t host_interval_sum;
+  uint64_t host_interval_max;
+};
+
+int playback_clock_init(struct playback_clock * clock, enum playback_clock_mode mode,
+  unsigned int rate_hz, unsigned int speed);
+void playback_clock_close(struct playback_clock * clock);
+
+void playback_clock_start(struct playback_clock * clock);
+//the next report is due now, for when playback jumps
+void playback_clock_resync(struct playback_clock * clock);
+void playback_clock_stop(struct playback_clock * clock);
+int playback_clock_set_speed(struct playback_clock * clock, unsigned int speed);
+
+//call when the timer fd is readable
+void playback_clock_fire(struct playback_clock * clock);
+//call for every output report the host sends
+void playback_clock_host_report(struct playback_clock * clock);
+
+//returns how many reports are due now
+int playback_clock_due(struct playback_clock * clock);
+//call after each report is sent
+void playback_clock_sent(struct playback_clock * clock);
+
+void playback_clock_print_stats(const struct playback_clock * clock);
+
+#endif
@@ -0,0 +1,103 @@
+#include "report_scheduler.h"
+#include "wm_time.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <unistd.h>
+#include <sys/timerfd.h>
+
+int report_scheduler_init(struct report_scheduler * sched, unsigned int rate_hz)
+{
+  struct itimerspec its;
+
+  memset(sched, 0, sizeof(struct report_scheduler));
+
+  if (rate_hz == 0 || rate_hz > 1000)
+  {
+    printf("report rate %u Hz out of range (1-1000)\n", rate_hz);
+    sched->fd = -1;
+    return -1;
+  }
+
+  sched->fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (sched->fd < 0)
+  {
+    printf("Unable to create report timer: %s\n", strerror(errno));
+    return -1;
+  }
+
+  sched->period_us = 1000000 / rate_hz;
+
+  memset(&its, 0, sizeof(its));
+  its.it_interval.tv_sec = sched->period_us / 1000000;
+  its.it_interval.tv_nsec = (sched->period_us % 1000000) * 1000;
+  its.it_value = its.it_interval;
+
+  if (timerfd_settime(sched->fd, 0, &its, NULL) < 0)
+  {
+    printf("Unable to arm report timer: %s\n", strerror(errno));
+    report_scheduler_close(sched);
+    return -1;
+  }
+
+  sched->start = wm_time_us();
+
+  return 0;
+}
+
+void report_scheduler_close(struct report_scheduler * sched)
+{
+  if (sched->fd >= 0)
+  {
+    close(sched->fd);
+    sched->fd = -1;
+  }
+}
+
+//call when the timer fd is readable, returns 1 if a report is due
+int report_scheduler_fire(struct report_scheduler * sched)
+{
+  uint64_t count;
+  uint64_t now, deadline, latency;
+
+  if (read(sched->fd, &count, sizeof(count)) != sizeof(count))
+  {
+    return (errno == EAGAIN) ? 0 : -1;
+  }
+
+  now = wm_time_us();
+
+  //only the latest deadline gets a report, earlier ones are dropped
+  sched->expirations += count;
+  sched->missed += count - 1;
+  sched->ticks++;
+
+  deadline = sched->start + sched->expirations * sched->period_us;
+  latency = (now > deadline) ? now - deadline : 0;
+
+  sched->latency_sum += latency;
+  sched->latency_sum_sq += latency * latency;
+  if (latency > sched->latency_max)
+  {
+    sched->latency_max = latency;
+  }
+
+  return 1;
+}
+
+void report_scheduler_print_stats(const struct report_scheduler * sched)
+{
+  double mean, var;
+
+  if (sched->ticks == 0) return;
+
+  mean = (double)sched->latency_sum / sched->ticks;
+  var = (double)sched->latency_sum_sq / sched->ticks - mean * mean;
+
+  printf("report timer: %u Hz, %llu ticks, %llu missed, jitter mean %.1f us, stddev %.1f us, max %llu us\n",
+    1000000 / sched->period_us,
+    (unsigned long long)sched->ticks, (unsigned long long)sched->missed,
+    mean, sqrt(var > 0 ? var : 0), (unsigned long long)sched->latency_max);
+}
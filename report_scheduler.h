@@ -0,0 +1,30 @@
+#ifndef REPORT_SCHEDULER_H
+#define REPORT_SCHEDULER_H
+
+#include <stdint.h>
+
+//a real wiimote sends data reports at about 100Hz
+#define REPORT_RATE_DEFAULT 100
+
+struct report_scheduler
+{
+  int fd; //timerfd, readable when a report is due
+  uint32_t period_us;
+  uint64_t start; //wm_time_us when the timer was armed
+  uint64_t expirations; //timer periods elapsed since start
+
+  //wakeup latency relative to each deadline
+  uint64_t ticks;
+  uint64_t missed; //periods that passed without a wakeup of their own
+  uint64_t latency_sum;
+  uint64_t latency_sum_sq;
+  uint64_t latency_max;
+};
+
+int report_scheduler_init(struct report_scheduler * sched, unsigned int rate_hz);
+void report_scheduler_close(struct report_scheduler * sched);
+
+int report_scheduler_fire(struct report_scheduler * sched);
+void report_scheduler_print_stats(const struct report_scheduler * sched);
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef SPSC_RING_H
+#define SPSC_RING_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+//single producer, single consumer ring of reports. the producer only writes
+//head and the consumer only writes tail, so neither side ever takes a lock
+//or waits for the other; a push to a full ring is dropped and counted
+
+//must be a power of two
+#define SPSC_RING_SIZE 256
+//reports are at most 23 bytes, 32 leaves room for anything odd
+#define SPSC_RING_SLOT 32
+
+struct spsc_ring_slot
+{
+  uint64_t time; //wm_time_us when the report was received
+  uint8_t len;
+  uint8_t data[SPSC_RING_SLOT];
+};
+
+struct spsc_ring
+{
+  //on their own cache lines, so the two threads don't share one
+  uint32_t head __attribute__((aligned(64))); //next slot to fill
+  uint32_t tail __attribute__((aligned(64))); //next slot to read
+  uint64_t dropped __attribute__((aligned(64))); //pushes that found the ring full
+
+  struct spsc_ring_slot slots[SPSC_RING_SIZE];
+};
+
+//producer side, returns false if the ring was full
+static inline bool spsc_ring_push(struct spsc_ring * ring, const uint8_t * buf, int len, uint64_t time)
+{
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE);
+  struct spsc_ring_slot * slot;
+
+  if (head - tail == SPSC_RING_SIZE)
+  {
+    __atomic_store_n(&ring->dropped, ring->dropped + 1, __ATOMIC_RELAXED);
+    return false;
+  }
+
+  if (len > SPSC_RING_SLOT) len = SPSC_RING_SLOT;
+  if (len < 0) len = 0;
+
+  slot = &ring->slots[head & (SPSC_RING_SIZE - 1)];
+  slot->time = time;
+  slot->len = len;
+  memcpy(slot->data, buf, len);
+
+  //publishes the slot contents along with the new head
+  __atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+//consumer side, the oldest report or NULL if the ring is empty. it stays
+//valid until spsc_ring_pop
+static inline const struct spsc_ring_slot * spsc_ring_peek(struct spsc_ring * ring)
+{
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+  uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+
+  if (head == tail)
+  {
+    return NULL;
+  }
+
+  return &ring->slots[tail & (SPSC_RING_SIZE - 1)];
+}
+
+static inline void spsc_ring_pop(struct spsc_ring * ring)
+{
+  uint32_t tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+  //hands the slot back to the producer
+  __atomic_store_n(&ring->tail, tail + 1, __ATOMIC_RELEASE);
+}
+
+static inline uint64_t spsc_ring_dropped(struct spsc_ring * ring)
+{
+  return __atomic_load_n(&ring->dropped, __ATOMIC_RELAXED);
+}
+
+#endif
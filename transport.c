@@ -0,0 +1,274 @@
+#include "transport.h"
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <bluetooth/l2cap.h>
+
+static int l2cap_create_socket()
+{
+  int fd;
+  struct linger l = { .l_onoff = 1, .l_linger = 5 };
+  int opt = 0;
+
+  fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  if (setsockopt(fd, SOL_L2CAP, L2CAP_LM, &opt, sizeof(opt)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int l2cap_listen(const bdaddr_t * local, int psm)
+{
+  int fd;
+  struct sockaddr_l2 addr;
+
+  fd = l2cap_create_socket();
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.l2_family = AF_BLUETOOTH;
+  addr.l2_psm = htobs(psm);
+  addr.l2_bdaddr = (local != NULL) ? *local : *BDADDR_ANY;
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  if (listen(fd, 1) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int l2cap_connect(const bdaddr_t * local, const bdaddr_t * remote, int psm)
+{
+  int fd;
+  struct sockaddr_l2 addr;
+
+  fd = l2cap_create_socket();
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  if (local != NULL)
+  {
+    memset(&addr, 0, sizeof(addr));
+    addr.l2_family = AF_BLUETOOTH;
+    addr.l2_psm    = htobs(psm);
+    addr.l2_bdaddr = *local;
+
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+    {
+      close(fd);
+      return -1;
+    }
+  }
+
+  memset(&addr, 0, sizeof(addr));
+  addr.l2_family = AF_BLUETOOTH;
+  addr.l2_psm    = htobs(psm);
+  addr.l2_bdaddr = *remote;
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int l2cap_accept(int listen_fd, bdaddr_t * remote)
+{
+  int fd;
+  struct sockaddr_l2 addr;
+  socklen_t opt = sizeof(addr);
+
+  fd = accept(listen_fd, (struct sockaddr *)&addr, &opt);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  if (remote != NULL)
+  {
+    *remote = addr.l2_bdaddr;
+  }
+
+  return fd;
+}
+
+struct transport transport_l2cap = {
+  .listen = l2cap_listen,
+  .connect = l2cap_connect,
+  .accept = l2cap_accept
+};
+
+static char loopback_dir[64] = ".";
+
+int transport_loopback_init(const char * dir)
+{
+  struct stat st;
+
+  if (strlen(dir) >= sizeof(loopback_dir))
+  {
+    printf("loopback directory %s is too long\n", dir);
+    return -1;
+  }
+
+  if (stat(dir, &st) < 0 || !S_ISDIR(st.st_mode))
+  {
+    printf("loopback directory %s doesn't exist\n", dir);
+    return -1;
+  }
+
+  strcpy(loopback_dir, dir);
+  return 0;
+}
+
+//listening sockets are <dir>/<bdaddr>.<psm>, connecting sockets bind
+//<dir>/<bdaddr>.<psm>.out so the listener can tell who connected
+static void loopback_addr(struct sockaddr_un * addr, const bdaddr_t * bdaddr, int psm, bool out)
+{
+  char straddr[18];
+
+  ba2str((bdaddr != NULL) ? bdaddr : BDADDR_ANY, straddr);
+
+  memset(addr, 0, sizeof(struct sockaddr_un));
+  addr->sun_family = AF_UNIX;
+  snprintf(addr->sun_path, sizeof(addr->sun_path), "%s/%s.%d%s",
+    loopback_dir, straddr, psm, out ? ".out" : "");
+}
+
+static int loopback_listen(const bdaddr_t * local, int psm)
+{
+  int fd;
+  struct sockaddr_un addr;
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  loopback_addr(&addr, local, psm, false);
+  unlink(addr.sun_path);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  if (listen(fd, 1) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int loopback_connect(const bdaddr_t * local, const bdaddr_t * remote, int psm)
+{
+  int fd;
+  struct sockaddr_un addr;
+
+  fd = socket(AF_UNIX, SOCK_SEQPACKET, 0);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  loopback_addr(&addr, local, psm, true);
+  unlink(addr.sun_path);
+
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  loopback_addr(&addr, remote, psm, false);
+
+  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  {
+    close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+static int loopback_accept(int listen_fd, bdaddr_t * remote)
+{
+  int fd;
+  struct sockaddr_un addr;
+  socklen_t len = sizeof(addr);
+  const char * name;
+
+  memset(&addr, 0, sizeof(addr));
+  fd = accept(listen_fd, (struct sockaddr *)&addr, &len);
+  if (fd < 0)
+  {
+    return -1;
+  }
+
+  if (remote != NULL)
+  {
+    //recover the peer's bdaddr from its socket name
+    char straddr[18] = { 0 };
+
+    name = strrchr(addr.sun_path, '/');
+    name = (name != NULL) ? name + 1 : addr.sun_path;
+    strncpy(straddr, name, 17);
+
+    if (bachk(straddr) < 0 || str2ba(straddr, remote) < 0)
+    {
+      *remote = *BDADDR_ANY;
+    }
+  }
+
+  return fd;
+}
+
+struct transport transport_loopback = {
+  .listen = loopback_listen,
+  .connect = loopback_connect,
+  .accept = loopback_accept
+};
@@ -0,0 +1,31 @@
+#ifndef TRANSPORT_H
+#define TRANSPORT_H
+
+#include <bluetooth/bluetooth.h>
+
+#define PSM_SDP 1
+#define PSM_CTRL 0x11
+#define PSM_INT 0x13
+
+//how the ctrl/int channels are opened, every call returns a
+//SOCK_SEQPACKET fd or -1 with errno set
+struct transport
+{
+  //local may be NULL to listen on any adapter
+  int (*listen)(const bdaddr_t * local, int psm);
+  //local may be NULL to let the system pick the adapter
+  int (*connect)(const bdaddr_t * local, const bdaddr_t * remote, int psm);
+  //remote may be NULL if the peer's address isn't needed
+  int (*accept)(int listen_fd, bdaddr_t * remote);
+};
+
+//bluetooth l2cap, the real thing
+extern struct transport transport_l2cap;
+
+//AF_UNIX stand-in for testing without an adapter, each listening psm is
+//a socket at <dir>/<bdaddr>.<psm>
+extern struct transport transport_loopback;
+
+int transport_loopback_init(const char * dir);
+
+#endif
@@ -7,6 +7,7 @@
 #endif
 
 #include "wm_crypto.h"
+#include "wm_layout.h"
 #include <string>
 #include <cstring>
 #include <iostream>
@@ -461,48 +462,55 @@ void clamp_acc(struct visuals *v) { // impossible to need?
 // assumes it's given an expected report
 // key length = 16
 void parse_report(struct visuals *v, const uint8_t *buf, struct ext_crypto_state* key) {
+    const struct report_layout *layout = report_get_layout(buf[1]);
+    if (layout == nullptr) return;
     //for (int i = 0; i < 16; ++i) printf("%02X ", key[i]);
-    v->LEFT = buf[2] & 0x01;
-    v->RIGHT = buf[2] & 0x02;
-    v->DOWN = buf[2] & 0x04;
-    v->UP = buf[2] & 0x08;
-    v->B = buf[3] & 0x04;
-    v->A = buf[3] & 0x08;
-	v->ONE = buf[3] & 0x02;
-	v->TWO = buf[3] & 0x01;
-	v->PLUS = buf[2] & 0x10;
-	v->MINUS = buf[3] & 0x10;
-	v->HOME = buf[3] & 0x80;
-    if (buf[1] != 0x30) { // other reporting modes dont have this as well...
-		v->accel[0] = (buf[4] << 2) + ((buf[2] & 0x60) >> 5);
-    	v->accel[1] = (buf[5] << 2) + ((buf[3] & 0x20) >> 4);
-    	v->accel[2] = (buf[6] << 2) + ((buf[3] & 0x40) >> 5);
-	}
+    if (layout->buttons >= 0) {
+        const uint8_t *btn = buf + 2 + layout->buttons;
+        v->LEFT = btn[0] & 0x01;
+        v->RIGHT = btn[0] & 0x02;
+        v->DOWN = btn[0] & 0x04;
+        v->UP = btn[0] & 0x08;
+        v->B = btn[1] & 0x04;
+        v->A = btn[1] & 0x08;
+        v->ONE = btn[1] & 0x02;
+        v->TWO = btn[1] & 0x01;
+        v->PLUS = btn[0] & 0x10;
+        v->MINUS = btn[1] & 0x10;
+        v->HOME = btn[1] & 0x80;
+        if (layout->accel >= 0) {
+            const uint8_t *acc = buf + 2 + layout->accel;
+            v->accel[0] = (acc[0] << 2) + ((btn[0] & 0x60) >> 5);
+            v->accel[1] = (acc[1] << 2) + ((btn[1] & 0x20) >> 4);
+            v->accel[2] = (acc[2] << 2) + ((btn[1] & 0x40) >> 5);
+        }
+    }
     v->ir[0] = 0;
     v->ir[1] = 0;
-    if (buf[1] == 0x33) {
-        v->hasNunchuk = false;
-        for (int i = 0; i < 4; i++) { // 12 byte IR // this is untested (probably broken)
-            v->ir[0] += buf[7 + i * 2] + ((buf[9 + i * 2] & 0x30) << 4);
-            v->ir[1] += buf[8 + i * 2] + ((buf[9 + i * 2] & 0xC0) << 2);
+    if (layout->ir_format == REPORT_IR_EXTENDED) {
+        const uint8_t *ir = buf + 2 + layout->ir;
+        for (int i = 0; i < layout->ir_length; i += 3) { // 12 byte IR, 3 bytes per object
+            v->ir[0] += ir[i + 0] + ((ir[i + 2] & 0x30) << 4);
+            v->ir[1] += ir[i + 1] + ((ir[i + 2] & 0xC0) << 2);
         }
-    } else if (buf[1] == 0x37) {
-        v->hasNunchuk = true;
-        for (int i = 7; i <=12; i += 5) { // 10 byte IR, 2 iterations
-            v->ir[0] += buf[i + 0] + ((buf[i + 2] & 0x30) << 4);
-            v->ir[1] += buf[i + 1] + ((buf[i + 2] & 0xC0) << 2);
-            v->ir[0] += buf[i + 3] + ((buf[i + 2] & 0x03) << 8);
-            v->ir[1] += buf[i + 4] + ((buf[i + 2] & 0x0C) << 6);
+    } else if (layout->ir_format == REPORT_IR_BASIC) {
+        const uint8_t *ir = buf + 2 + layout->ir;
+        for (int i = 0; i < layout->ir_length; i += 5) { // 10 byte IR, 2 objects per 5 bytes
+            v->ir[0] += ir[i + 0] + ((ir[i + 2] & 0x30) << 4);
+            v->ir[1] += ir[i + 1] + ((ir[i + 2] & 0xC0) << 2);
+            v->ir[0] += ir[i + 3] + ((ir[i + 2] & 0x03) << 8);
+            v->ir[1] += ir[i + 4] + ((ir[i + 2] & 0x0C) << 6);
         }
+    }
+    v->hasNunchuk = layout->extension_length >= 6;
+    if (v->hasNunchuk) {
         // ((data[i] ^ key[8 + i]) + key[i]) % 0x100
         uint8_t ext_data[6] = {0};
-        memcpy(ext_data, buf+17, sizeof(uint8_t)*6);
-        ext_decrypt_bytes(key, ext_data, 0, 6);
-        v->stick[0] = ext_data[0];//((buf[17] ^ key[8]) + key[0]) % 0x100;
-        v->stick[1] = ext_data[1];//((buf[18] ^ key[9]) + key[1]) % 0x100;
-        //printf("<- key\nbuf[17..22] = %02X %02X %02X %02X %02X %02X\n", buf[17], buf[18], buf[19], buf[20], buf[21], buf[22]);
-        uint8_t decrypted_final = ext_data[5];//((buf[22] ^ key[13]) + key[5]) % 0x100;
-        //printf("%02X ^ %02X + %02X\n", buf[22], key[13], key[5]);
+        memcpy(ext_data, buf + 2 + layout->extension, sizeof(uint8_t)*6);
+        ext_decrypt_bytes(key, ext_data, 0x08, 6);
+        v->stick[0] = ext_data[0];
+        v->stick[1] = ext_data[1];
+        uint8_t decrypted_final = ext_data[5];
         //printf("DECRYPTED BYTES: %02X %02X %02X\n", v->stick[0], v->stick[1], decrypted_final);
         v->Z = (decrypted_final & 0x1) == 0;
         v->C = (decrypted_final & 0x2) == 0;
@@ -552,12 +560,13 @@ enum KeyState {Uninitialized, EncryptionEnabled, Block1, Block2, Complete};
 int state = Uninitialized;
 
 // https://wiibrew.org/wiki/Wiimote/Protocol#Extension_Controllers
-void store_extension_key(const uint8_t *buf, int len) { // output report (from wii) buf[0]=a2
-	if (len < 1 + 6 + 16) return; // a2 16 MM FF FF FF SS + key
+// returns true when buf completes a key, extension_key() then has it
+bool store_extension_key(const uint8_t *buf, int len) { // output report (from wii) buf[0]=a2
+	if (len < 1 + 6 + 16) return false; // a2 16 MM FF FF FF SS + key
 	//if (state == Uninitialized) printf("Out Report: %02X %02X %02X %02X %02X %02X...\n", buf[0], buf[1], buf[2], buf[3], buf[4], buf[5]);
-	if (buf[1] != 0x16) return; // write memory register
-	if (buf[2] != 0x04) return; // enable write data
-	if (buf[3] != 0xA4 || buf[4] != 0x00) return; // register choice
+	if (buf[1] != 0x16) return false; // write memory register
+	if (buf[2] != 0x04) return false; // enable write data
+	if (buf[3] != 0xA4 || buf[4] != 0x00) return false; // register choice
 	if (state == Uninitialized) {
 		if (buf[5] == 0xF0 && buf[6] == 0x01 && buf[7] == 0xAA) {
 			state = EncryptionEnabled;
@@ -567,6 +576,7 @@ void store_extension_key(const uint8_t *buf, int len) { // output report (from w
 			//for (int i = 0; i < 16; ++i) printf("%02X ", extension_decryption_key[i]);
 			//printf("<- KEY COMPLETE\n");
 			ext_generate_tables(&decrypt_state, buf+7);
+			return true;
 		}
 	} else if (state == EncryptionEnabled) {
 		if (buf[5] == 0x40 && buf[6] == 0x06) {
@@ -605,8 +615,14 @@ void store_extension_key(const uint8_t *buf, int len) { // output report (from w
 			//for (int i = 0; i < 16; ++i) printf("%02X ", extension_decryption_key[i]);
 			//printf("<- KEY COMPLETE\n");
 			ext_generate_tables(&decrypt_state, extension_decryption_key);
+			return true;
 		}
 	}
+	return false;
+}
+
+const uint8_t *extension_key(void) {
+	return extension_decryption_key;
 }
 
 //int extkeycounter = 0;
@@ -7,7 +7,8 @@
 #include <stdint.h>
 
 bool init_visualizer(void);
-void store_extension_key(const uint8_t *buf, int len);
+bool store_extension_key(const uint8_t *buf, int len); // true once a key is complete
+const uint8_t *extension_key(void); // last complete key, zeros before one is seen
 void visualize_inputs(const uint8_t *buf, int len); //, const unit8_t *key);
 bool exit_visualizer(void);
 
@@ -1,7 +1,9 @@
 #include "wiimote.h"
 
 #include "wm_reports.h"
+#include "wm_time.h"
 
+#include <stddef.h>
 #include <string.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -109,12 +111,18 @@ int process_report(struct wiimote_state *state, const uint8_t * buf, int len)
   return 0;
 }
 
-int generate_report(struct wiimote_state * state, uint8_t * buf)
+static bool report_keepalive_due(struct wiimote_state * state)
 {
-  int len;
+  if (state->report_keepalive_us == 0) return false;
 
-  struct report_data * data = (struct report_data *)buf;
-  uint8_t * contents;
+  return wm_time_us() - state->sys.last_report_time >= state->report_keepalive_us;
+}
+
+//work done once per report tick, not for replies sent between ticks
+static void wiimote_tick(struct wiimote_state * state)
+{
+  //write back eeprom changes once they've settled
+  eeprom_flush(&state->eeprom, false);
 
   if (state->usr.connected_extension_type != state->sys.connected_extension_type)
   {
@@ -135,11 +143,26 @@ int generate_report(struct wiimote_state * state, uint8_t * buf)
       init_extension(state);
     }
   }
+}
 
-  if (!state->sys.reporting_continuous && !state->sys.report_changed && state->sys.queue == NULL)
-    return 0;
+static int build_report(struct wiimote_state * state, uint8_t * buf)
+{
+  int len;
+
+  struct report_data * data = (struct report_data *)buf;
+  uint8_t * contents;
+
+  struct report mem_rpt;
+  struct report * rpt = report_queue_peek(state);
+  bool queued = (rpt != NULL);
 
-  if (state->sys.queue == NULL)
+  if (!queued && report_next_mem_resp(state, &mem_rpt))
+  {
+    //next chunk of a pending memory read
+    rpt = &mem_rpt;
+  }
+
+  if (rpt == NULL)
   {
     //regular report
     memset(data, 0, sizeof(struct report_data));
@@ -150,89 +173,74 @@ int generate_report(struct wiimote_state * state, uint8_t * buf)
   else
   {
     //queued report (acknowledgement, response, etc)
-    struct report * rpt;
-    rpt = report_queue_peek(state);
     len = rpt->len;
     memcpy(data, &rpt->data, sizeof(struct report_data));
-    report_queue_pop(state);
+    if (queued)
+    {
+      report_queue_pop(state);
+    }
   }
 
   contents = data->buf;
 
   //fill report
-  switch (data->type)
+  int payload_len = report_encode_input(state, data->type, contents);
+  if (payload_len >= 0)
   {
-    case 0x30: // core buttons
-      report_append_buttons(state, contents);
-      len += 2;
-      break;
-    case 0x31: // core buttons + accelerometer
-      report_append_buttons(state, contents);
-      report_append_accelerometer(state, contents);
-      len += 2 + 3;
-      break;
-    case 0x32: // core buttons + 8 extension bytes
-      report_append_buttons(state, contents);
-      len += 2 + 8;
-      break;
-    case 0x33: // core buttons + accelerometer + 12 ir bytes
-      report_append_buttons(state, contents);
-      report_append_accelerometer(state, contents);
-      report_append_ir_12(state, contents + 5);
-      len += 2 + 3 + 12;
-      break;
-    case 0x34: // core buttons + 19 extension bytes
-      report_append_buttons(state, contents);
-      report_append_extension(state, contents + 2, 19);
-      len += 2 + 19;
-      break;
-    case 0x35: // core buttons + accelerometer + 16 extension bytes
-      report_append_buttons(state, contents);
-      report_append_accelerometer(state, contents);
-      report_append_extension(state, contents + 5, 16);
-      len += 2 + 3 + 16;
-      break;
-    case 0x36: // core buttons + 10 ir bytes + 9 extension bytes
-      report_append_buttons(state, contents);
-      report_append_ir_10(state, contents + 2);
-      report_append_extension(state, contents + 12, 9);
-      len += 2 + 10 + 9;
-      break;
-    case 0x37: // core buttons + accelerometer + 10 ir bytes + 6 extension bytes
-      report_append_buttons(state, contents);
-      report_append_accelerometer(state, contents);
-      report_append_ir_10(state, contents + 5);
-      report_append_extension(state, contents + 15, 6);
-      len += 2 + 3 + 10 + 6;
-      break;
-    case 0x3d: // 21 extension bytes
-      report_append_extension(state, contents, 21);
-      len += 21;
-      break;
-    case 0x3e: // interleaved core buttons + accelerometer with 36 ir bytes pt I
-    case 0x3f: // interleaved core buttons + accelerometer with 36 ir bytes pt II
-      report_append_buttons(state, contents);
-      report_append_interleaved(state, contents);
-      len += 21;
-      break;
-    default: // special output report (acknowledgement, status, or memory read)
-      report_append_buttons(state, contents);
-      break;
+    len = 2 + payload_len;
+
+    state->sys.report_changed = (data->type != state->sys.last_report_type) ||
+      (memcmp(contents, state->sys.last_report, payload_len) != 0);
+
+    if (rpt == NULL && !state->sys.reporting_continuous && !state->sys.report_changed &&
+      !report_keepalive_due(state))
+    {
+      //nothing new to tell the host
+      return 0;
+    }
+
+    state->sys.last_report_type = data->type;
+    memcpy(state->sys.last_report, contents, payload_len);
+    if (state->report_keepalive_us > 0)
+    {
+      state->sys.last_report_time = wm_time_us();
+    }
+  }
+  else
+  {
+    //special output report (acknowledgement, status, or memory read)
+    report_append_buttons(state, contents);
   }
 
   return len;
 }
 
+static void start_mem_read(struct wiimote_state * state, const uint8_t * source,
+  uint32_t source_size, uint32_t position, uint16_t addr, uint16_t size, bool encrypt)
+{
+  struct mem_read_request * req = &state->sys.mem_read;
+
+  if (req->remaining > 0)
+  {
+    //a real wiimote ignores new reads while one is still being answered
+    printf("read of %04x ignored, previous read still in progress\n", addr);
+    return;
+  }
+
+  //the response is generated 16 bytes at a time by generate_report
+  req->source = source;
+  req->source_size = source_size;
+  req->position = position;
+  req->addr = addr;
+  req->remaining = size;
+  req->encrypt = encrypt;
+}
+
 void read_eeprom(struct wiimote_state * state, uint32_t offset, uint16_t size)
 {
-  FILE * file;
-  uint8_t * buffer;
   struct report * rpt;
-  int i;
 
-  //Open file
-  file = fopen("eeprom.bin", "rb");
-  if (!file)
+  if (state->eeprom.data == NULL)
   {
     printf("Unable to open eeprom file");
     return;
@@ -244,53 +252,21 @@ void read_eeprom(struct wiimote_state * state, uint32_t offset, uint16_t size)
   if (offset + size > 0x16FF)
   {
     rpt = report_queue_push(state);
-    report_format_mem_resp(state, rpt, 0x10, 0x8, offset, NULL, false);
-    fclose(file);
-    return;
-  }
-
-  fseek(file, offset, SEEK_SET);
-
-  buffer = (uint8_t *)malloc(size);
-  if (!buffer)
-  {
-    fclose(file);
+    if (rpt != NULL)
+    {
+      report_format_mem_resp(state, rpt, 0x10, 0x8, offset, NULL, false);
+    }
     return;
   }
 
-  fread(buffer, 1, size, file);
-  fclose(file);
-
-  //equivalent to ceil(size / 0x10)
-  int total_packets = (size + 0x10 - 1) / 0x10;
-
-  //allocate all the needed reports
-  for (i = 0; i < total_packets; i++)
-  {
-    report_queue_push(state);
-  }
-
-  //copy packet data
-  struct queued_report * queue_item = state->sys.queue;
-
-  for (i = 0; i < total_packets; i++)
-  {
-    rpt = &queue_item->rpt;
-    int packet_size = (i == total_packets - 1) ? (size - i * 0x10) : 0x10;
-    report_format_mem_resp(state, rpt, packet_size, 0x0, offset + i*0x10, &buffer[i*0x10], false);
-    queue_item = queue_item->next;
-  }
-
-  free(buffer);
+  start_mem_read(state, state->eeprom.data, EEPROM_SIZE, offset, offset, size, false);
 }
 
 void write_eeprom(struct wiimote_state * state, uint32_t offset, uint8_t size, const uint8_t * buf)
 {
-  FILE * file;
   struct report * rpt;
 
-  file = fopen("eeprom.bin", "rb");
-  if (!file)
+  if (state->eeprom.data == NULL)
   {
     printf("Unable to open eeprom file");
     return;
@@ -302,30 +278,30 @@ void write_eeprom(struct wiimote_state * state, uint32_t offset, uint8_t size, c
   if (offset + size > 0x16FF)
   {
     rpt = report_queue_push(state);
-    report_format_mem_resp(state, rpt, 0x10, 0x8, offset, NULL, false);
-    fclose(file);
+    if (rpt != NULL)
+    {
+      report_format_mem_resp(state, rpt, 0x10, 0x8, offset, NULL, false);
+    }
     return;
   }
 
-  fseek(file, offset, SEEK_SET);
-
-  //write buffer into the eeprom file
-  fwrite(buf, 1, size, file);
-  fclose(file);
+  //applied to the mapping in place, synced to the file later
+  eeprom_write(&state->eeprom, offset, buf, size);
   report_queue_push_ack(state, 0x16, 0x00);
 }
 
 void read_register(struct wiimote_state *state, uint32_t offset, uint16_t size)
 {
-  uint8_t * buffer;
+  const uint8_t * reg;
+  uint32_t reg_size;
   struct report * rpt;
-  int i;
   bool encrypt = false;
 
   switch ((offset >> 16) & 0xfe) //select register, ignore lsb
   {
     case 0xa2: //speaker
-      buffer = state->sys.register_a2 + (offset & 0xff);
+      reg = state->sys.register_a2;
+      reg_size = sizeof(state->sys.register_a2);
       break;
     case 0xa4: //extension
       if (state->sys.wmp_state == 1)
@@ -342,11 +318,13 @@ void read_register(struct wiimote_state *state, uint32_t offset, uint16_t size)
           }
         }
 
-        buffer = state->sys.register_a6 + (offset & 0xff);
+        reg = state->sys.register_a6;
+        reg_size = sizeof(state->sys.register_a6);
       }
       else
       {
-        buffer = state->sys.register_a4 + (offset & 0xff);
+        reg = state->sys.register_a4;
+        reg_size = sizeof(state->sys.register_a4);
       }
 
       if (state->sys.extension_encrypted)
@@ -359,36 +337,29 @@ void read_register(struct wiimote_state *state, uint32_t offset, uint16_t size)
       if (state->sys.wmp_state == 1)
       {
          rpt = report_queue_push(state);
-         report_format_mem_resp(state, rpt, 0x10, 0x7, offset, NULL, false);
+         if (rpt != NULL)
+         {
+           report_format_mem_resp(state, rpt, 0x10, 0x7, offset, NULL, false);
+         }
          return;
       }
-      buffer = state->sys.register_a6 + (offset & 0xff);
+      reg = state->sys.register_a6;
+      reg_size = sizeof(state->sys.register_a6);
       break;
     case 0xb0: //ir camera
-      buffer = state->sys.register_b0 + (offset & 0xff);
+      reg = state->sys.register_b0;
+      reg_size = sizeof(state->sys.register_b0);
       break;
     default: //???
-      break;
-  }
-
-  //equivalent to ceil(size / 0x10)
-  int total_packets = (size + 0x10 - 1) / 0x10;
-
-  //allocate all the needed reports
-  for (i = 0; i < total_packets; i++)
-  {
-    report_queue_push(state);
+      rpt = report_queue_push(state);
+      if (rpt != NULL)
+      {
+        report_format_mem_resp(state, rpt, 0x10, 0x8, offset, NULL, false);
+      }
+      return;
   }
 
-  struct queued_report * queue_item = state->sys.queue;
-
-  for (i = 0; i < total_packets; i++)
-  {
-    rpt = &queue_item->rpt;
-    int packet_size = (i == total_packets - 1) ? (size - i * 0x10) : 0x10;
-    report_format_mem_resp(state, rpt, packet_size, 0x0, offset + i*0x10, &buffer[i*0x10], encrypt);
-    queue_item = queue_item->next;
-  }
+  start_mem_read(state, reg, reg_size, offset & 0xff, offset, size, encrypt);
 }
 
 void write_register(struct wiimote_state *state, uint32_t offset, uint8_t size, const uint8_t * buf)
@@ -436,8 +407,9 @@ void write_register(struct wiimote_state *state, uint32_t offset, uint8_t size,
       }
       else if ((offset & 0xff) == 0x4c) //last part of encryption code
       {
-        ext_generate_tables(&state->sys.extension_crypto_state, &reg[0x40]);
+        ext_generate_tables_cached(&state->key_cache, &state->sys.extension_crypto_state, &reg[0x40]);
         state->sys.extension_encrypted = 1;
+        report_invalidate_cache(state);
       }
       else if ((offset & 0xff) == 0xf0)
       {
@@ -449,6 +421,7 @@ void write_register(struct wiimote_state *state, uint32_t offset, uint8_t size,
         {
           state->sys.extension_encrypted = 0;
         }
+        report_invalidate_cache(state);
       }
       else if ((offset & 0xff) == 0xf1)
       {
@@ -533,7 +506,7 @@ void write_register(struct wiimote_state *state, uint32_t offset, uint8_t size,
       {
         state->sys.wmp_state = 1;
         state->sys.extension_report_type = (buf[0] & 0x7);
-        printf("activate wmp\n");
+        fprintf(stderr, "activate wmp\n");
 
         init_extension(state);
 
@@ -816,16 +789,83 @@ void init_extension(struct wiimote_state * state)
     state->sys.extension_report_type = state->sys.register_a4[0xfe];
     state->sys.extension_type = state->sys.register_a4[0xff];
   }
+
+  //extension bytes are encoded differently now
+  report_invalidate_cache(state);
+}
+
+//one scheduler tick, the per tick upkeep then the next report
+int generate_report(struct wiimote_state * state, uint8_t * buf)
+{
+  wiimote_tick(state);
+  return build_report(state, buf);
+}
+
+//a queued reply sent between ticks, leaves the per tick state alone
+int generate_reply(struct wiimote_state * state, uint8_t * buf)
+{
+  if (!wiimote_reply_pending(state))
+  {
+    return 0;
+  }
+
+  return build_report(state, buf);
+}
+
+//true while acks, status or memory read chunks are waiting to be sent
+bool wiimote_reply_pending(struct wiimote_state * state)
+{
+  return report_queue_peek(state) != NULL || state->sys.mem_read.remaining > 0;
+}
+
+void wiimote_mark_dirty(struct wiimote_state * state,
+  const struct wiimote_state_usr * before, uint8_t sections)
+{
+  const struct wiimote_state_usr * usr = &state->usr;
+  uint8_t dirty = 0;
+
+  //buttons are the bools from a up to the special buttons
+  if ((sections & REPORT_DIRTY_BUTTONS) &&
+    memcmp(&usr->a, &before->a, offsetof(struct wiimote_state_usr, sync) - offsetof(struct wiimote_state_usr, a)) != 0)
+  {
+    dirty |= REPORT_DIRTY_BUTTONS;
+  }
+
+  if ((sections & REPORT_DIRTY_ACCEL) &&
+    (usr->accel_x != before->accel_x || usr->accel_y != before->accel_y || usr->accel_z != before->accel_z))
+  {
+    dirty |= REPORT_DIRTY_ACCEL;
+  }
+
+  if ((sections & REPORT_DIRTY_IR) &&
+    memcmp(usr->ir_object, before->ir_object, sizeof(usr->ir_object)) != 0)
+  {
+    dirty |= REPORT_DIRTY_IR;
+  }
+
+  if ((sections & REPORT_DIRTY_EXTENSION) &&
+    (memcmp(&usr->nunchuk, &before->nunchuk, sizeof(usr->nunchuk)) != 0 ||
+     memcmp(&usr->classic, &before->classic, sizeof(usr->classic)) != 0 ||
+     memcmp(&usr->motionplus, &before->motionplus, sizeof(usr->motionplus)) != 0))
+  {
+    dirty |= REPORT_DIRTY_EXTENSION;
+  }
+
+  state->usr.dirty |= dirty;
 }
 
 void wiimote_destroy(struct wiimote_state *state)
 {
-  while (state->sys.queue != NULL)
+  if (state->sys.queue.overflows > 0)
   {
-    struct queued_report * rpt = state->sys.queue;
-    state->sys.queue = rpt->next;
-    free(rpt);
+    printf("report queue overflowed, %u reports dropped\n", state->sys.queue.overflows);
   }
+
+  //discard anything still queued
+  state->sys.queue.head = state->sys.queue.tail;
+  state->sys.mem_read.remaining = 0;
+
+  eeprom_close(&state->eeprom);
 }
 
 void wiimote_init(struct wiimote_state *state)
@@ -844,9 +884,13 @@ void wiimote_init(struct wiimote_state *state)
 
   state->usr.connected_extension_type = NoExtension;
 
+  state->report_keepalive_us = REPORT_KEEPALIVE_US;
+
+  eeprom_open(&state->eeprom, "eeprom.bin");
+
   wiimote_reset(state);
 
-  //power on report
+  //power on report (the queue is empty after reset, so this can't fail)
   struct report * rpt = report_queue_push(state);
   rpt->len = 4;
   rpt->data.io = 0xa1;
@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include "wm_crypto.h"
+#include "eeprom.h"
 
 enum wiimote_connected_extension_type
 {
@@ -103,14 +104,70 @@ struct wiimote_state_usr
   struct wiimote_nunchuk nunchuk;
   struct wiimote_classic classic;
   struct wiimote_motionplus motionplus;
+
+  uint8_t dirty; //REPORT_DIRTY_* sections changed since the last encoded report
 };
 
+//sections of wiimote_state_usr that input reports are encoded from
+#define REPORT_DIRTY_BUTTONS   0x01
+#define REPORT_DIRTY_ACCEL     0x02
+#define REPORT_DIRTY_IR        0x04
+#define REPORT_DIRTY_EXTENSION 0x08
+#define REPORT_DIRTY_ALL       0x0f
+
 void reset_ir_object(struct wiimote_ir_object * object);
 void reset_input_ir(struct wiimote_ir_object ir_object[4]);
 void reset_input_nunchuk(struct wiimote_nunchuk * nunchuk);
 void reset_input_classic(struct wiimote_classic * classic);
 void reset_input_motionplus(struct wiimote_motionplus * motionplus);
 
+//number of reports the outgoing queue can hold, must be a power of two
+#ifndef REPORT_QUEUE_SIZE
+#define REPORT_QUEUE_SIZE 64
+#endif
+
+#if (REPORT_QUEUE_SIZE & (REPORT_QUEUE_SIZE - 1)) != 0
+#error "REPORT_QUEUE_SIZE must be a power of two"
+#endif
+
+//default interval (us) to repeat an unchanged report in non-continuous mode, 0 never
+#ifndef REPORT_KEEPALIVE_US
+#define REPORT_KEEPALIVE_US 0
+#endif
+
+struct report_data
+{
+  uint8_t io;
+  uint8_t type;
+  uint8_t buf[21];
+  uint8_t padding;
+} __attribute__((packed));
+
+struct report
+{
+  uint32_t len;  //data (packet) length
+  struct report_data data;
+};
+
+struct report_queue
+{
+  struct report slots[REPORT_QUEUE_SIZE];
+  uint32_t head; //next slot to send, free running
+  uint32_t tail; //next slot to fill, free running
+  uint32_t overflows; //reports dropped because the queue was full
+};
+
+//pending 0x17 memory read, answered 16 bytes per report
+struct mem_read_request
+{
+  const uint8_t * source; //register or eeprom image being read
+  uint32_t source_size;
+  uint32_t position; //index into source of the next chunk
+  uint16_t addr; //address reported back to the host
+  uint16_t remaining; //bytes left to send, 0 when idle
+  bool encrypt;
+};
+
 struct wiimote_state_sys
 {
   bool led_1;
@@ -141,8 +198,17 @@ struct wiimote_state_sys
   bool reporting_continuous;
   bool report_changed;
 
-  struct queued_report * queue;
-  struct queued_report * queue_end;
+  struct report_queue queue;
+  struct mem_read_request mem_read;
+
+  //last encoded input report payload, only dirty sections are rebuilt
+  uint8_t encoded_mode; //0 when the cache is invalid
+  uint8_t encoded[21];
+
+  //last input report sent, non-continuous reporting only sends changes
+  uint8_t last_report_type;
+  uint8_t last_report[21];
+  uint64_t last_report_time; //only kept when a keepalive is set
 
   uint8_t register_a2[10]; //speaker
   uint8_t register_a4[256]; //extension
@@ -154,6 +220,11 @@ struct wiimote_state
 {
   struct wiimote_state_sys sys;
   struct wiimote_state_usr usr;
+
+  struct eeprom eeprom; //mapped by wiimote_init
+  struct ext_key_cache key_cache; //kept across resets and reconnects
+
+  uint32_t report_keepalive_us; //see REPORT_KEEPALIVE_US
 };
 
 void wiimote_init(struct wiimote_state *state);
@@ -162,7 +233,11 @@ void wiimote_destroy(struct wiimote_state *state);
 void wiimote_reset(struct wiimote_state *state);
 
 int process_report(struct wiimote_state *state, const uint8_t *buf, int len);
+//one report tick: per tick upkeep (hotplug delay, eeprom write back), then
+//the next reply or the current data report
 int generate_report(struct wiimote_state * state, uint8_t * buf);
+//the next queued reply or memory read chunk without ticking, 0 if none
+int generate_reply(struct wiimote_state * state, uint8_t * buf);
 
 void read_eeprom(struct wiimote_state * state, uint32_t offset, uint16_t size);
 void write_eeprom(struct wiimote_state * state, uint32_t offset, uint8_t size, const uint8_t * buf);
@@ -170,5 +245,9 @@ void read_register(struct wiimote_state *state, uint32_t offset, uint16_t size);
 void write_register(struct wiimote_state *state, uint32_t offset, uint8_t size, const uint8_t * buf);
 
 void init_extension(struct wiimote_state *state);
+bool wiimote_reply_pending(struct wiimote_state * state);
+
+void wiimote_mark_dirty(struct wiimote_state * state,
+  const struct wiimote_state_usr * before, uint8_t sections);
 
 #endif //WIIMOTE_H
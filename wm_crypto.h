@@ -9,10 +9,44 @@ struct ext_crypto_state
   uint8_t sb[8];
 };
 
+//a run of extension bytes whose first byte sits at addr_offset in the
+//extension register space
+struct ext_crypto_span
+{
+  uint8_t * buffer;
+  int addr_offset;
+  int length;
+};
+
+//hosts re-send the same key on every extension hotplug, so the tables for
+//the last few keys are kept around. must be a power of two
+#define EXT_KEY_CACHE_SIZE 8
+
+struct ext_key_cache_entry
+{
+  uint8_t key[16];
+  struct ext_crypto_state state;
+};
+
+//all zeroes is an empty cache
+struct ext_key_cache
+{
+  struct ext_key_cache_entry entries[EXT_KEY_CACHE_SIZE];
+  uint32_t count; //entries ever added, the oldest is replaced once full
+  uint32_t hits;
+  uint32_t misses;
+};
+
 void ext_generate_tables(struct ext_crypto_state * state, const uint8_t key[16]);
+//same as ext_generate_tables, but looks the key up in cache first
+void ext_generate_tables_cached(struct ext_key_cache * cache,
+  struct ext_crypto_state * state, const uint8_t key[16]);
 void ext_encrypt_bytes(const struct ext_crypto_state * state, uint8_t * buffer,
   int addr_offset, int length);
 void ext_decrypt_bytes(const struct ext_crypto_state * state, uint8_t * buffer,
   int addr_offset, int length);
+//decrypts every span in place, in one pass over the list
+void ext_decrypt_spans(const struct ext_crypto_state * state,
+  const struct ext_crypto_span * spans, int count);
 
 #endif
@@ -0,0 +1,65 @@
+#ifndef WM_LAYOUT_H
+#define WM_LAYOUT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+//Shared by the emulator, the dtm reader and the mitm visualizer, so a new
+//reporting mode only needs a row in report_layouts.
+
+#define REPORT_MODE_FIRST 0x30
+#define REPORT_MODE_LAST  0x3f
+
+enum report_ir_format
+{
+  REPORT_IR_NONE,
+  REPORT_IR_BASIC,       //10 bytes, 2 objects per 5 bytes
+  REPORT_IR_EXTENDED,    //12 bytes, 3 bytes per object
+  REPORT_IR_INTERLEAVED, //full format split over 0x3e/0x3f, includes the accelerometer
+};
+
+//offsets are into report_data.buf (add 2 to index the raw packet),
+//-1 if the section isn't part of the report
+struct report_layout
+{
+  uint8_t length; //bytes after the report type, 0 for unused modes
+  int8_t buttons;
+  int8_t accel; //the 3 msb bytes, the lsbs are packed into the button bytes
+  uint8_t ir_format;
+  int8_t ir;
+  uint8_t ir_length;
+  int8_t extension;
+  uint8_t extension_length;
+};
+
+static const struct report_layout report_layouts[REPORT_MODE_LAST - REPORT_MODE_FIRST + 1] =
+{
+  //len btn acc  ir format                ir  len  ext  len
+  {  2,  0, -1, REPORT_IR_NONE,        -1,  0, -1,  0 }, //0x30 core buttons
+  {  5,  0,  2, REPORT_IR_NONE,        -1,  0, -1,  0 }, //0x31 core buttons + accelerometer
+  { 10,  0, -1, REPORT_IR_NONE,        -1,  0,  2,  8 }, //0x32 core buttons + 8 extension bytes
+  { 17,  0,  2, REPORT_IR_EXTENDED,     5, 12, -1,  0 }, //0x33 core buttons + accelerometer + 12 ir bytes
+  { 21,  0, -1, REPORT_IR_NONE,        -1,  0,  2, 19 }, //0x34 core buttons + 19 extension bytes
+  { 21,  0,  2, REPORT_IR_NONE,        -1,  0,  5, 16 }, //0x35 core buttons + accelerometer + 16 extension bytes
+  { 21,  0, -1, REPORT_IR_BASIC,        2, 10, 12,  9 }, //0x36 core buttons + 10 ir bytes + 9 extension bytes
+  { 21,  0,  2, REPORT_IR_BASIC,        5, 10, 15,  6 }, //0x37 core buttons + accelerometer + 10 ir bytes + 6 extension bytes
+  {  0, -1, -1, REPORT_IR_NONE,        -1,  0, -1,  0 }, //0x38
+  {  0, -1, -1, REPORT_IR_NONE,        -1,  0, -1,  0 }, //0x39
+  {  0, -1, -1, REPORT_IR_NONE,        -1,  0, -1,  0 }, //0x3a
+  {  0, -1, -1, REPORT_IR_NONE,        -1,  0, -1,  0 }, //0x3b
+  {  0, -1, -1, REPORT_IR_NONE,        -1,  0, -1,  0 }, //0x3c
+  { 21, -1, -1, REPORT_IR_NONE,        -1,  0,  0, 21 }, //0x3d 21 extension bytes
+  { 21,  0, -1, REPORT_IR_INTERLEAVED,  3, 18, -1,  0 }, //0x3e interleaved core buttons + accelerometer with 36 ir bytes pt I
+  { 21,  0, -1, REPORT_IR_INTERLEAVED,  3, 18, -1,  0 }, //0x3f interleaved core buttons + accelerometer with 36 ir bytes pt II
+};
+
+//returns NULL if type isn't an input data report
+static inline const struct report_layout * report_get_layout(uint8_t type)
+{
+  if (type < REPORT_MODE_FIRST || type > REPORT_MODE_LAST) return NULL;
+  if (report_layouts[type - REPORT_MODE_FIRST].length == 0) return NULL;
+
+  return &report_layouts[type - REPORT_MODE_FIRST];
+}
+
+#endif
@@ -8,55 +8,48 @@
 
 struct report * report_queue_push(struct wiimote_state * state)
 {
-  struct queued_report * rpt;
+  struct report_queue * queue = &state->sys.queue;
+  struct report * rpt;
 
-  //allocate new report
-  rpt = (struct queued_report *)malloc(sizeof(struct queued_report));
-  memset(rpt, 0, sizeof(struct queued_report));
-
-  //append to the end of the queue
-  if (state->sys.queue_end != NULL)
-  {
-    state->sys.queue_end->next = rpt;
-  }
-  else
+  if (queue->tail - queue->head >= REPORT_QUEUE_SIZE)
   {
-    state->sys.queue = rpt;
+    //queue is full, drop the report
+    queue->overflows++;
+    return NULL;
   }
-  state->sys.queue_end = rpt;
 
-  return &(rpt->rpt);
+  //claim the next free slot
+  rpt = &queue->slots[queue->tail & (REPORT_QUEUE_SIZE - 1)];
+  memset(rpt, 0, sizeof(struct report));
+  queue->tail++;
+
+  return rpt;
 }
 
 struct report * report_queue_peek(struct wiimote_state * state)
 {
-  if (state->sys.queue == NULL) return NULL; //empty queue
+  struct report_queue * queue = &state->sys.queue;
+
+  if (queue->head == queue->tail) return NULL; //empty queue
 
-  return &(state->sys.queue->rpt);
+  return &queue->slots[queue->head & (REPORT_QUEUE_SIZE - 1)];
 }
 
 void report_queue_pop(struct wiimote_state * state)
 {
-  struct queued_report * rpt;
+  struct report_queue * queue = &state->sys.queue;
 
-  if (state->sys.queue == NULL) return; //nothing to remove
-
-  //remove from the queue
-  rpt = state->sys.queue;
-  if (state->sys.queue_end == rpt)
-  {
-    state->sys.queue_end = NULL;
-  }
-  state->sys.queue = rpt->next;
+  if (queue->head == queue->tail) return; //nothing to remove
 
-  //free report mem
-  free(rpt);
+  queue->head++;
 }
 
 void report_queue_push_ack(struct wiimote_state *state, uint8_t report, uint8_t result)
 {
   //push acknowledgement report x22
   struct report * rpt = report_queue_push(state);
+  if (rpt == NULL) return;
+
   rpt->len = 6;
   rpt->data.io = 0xa1;
   rpt->data.type = 0x22;
@@ -70,6 +63,8 @@ void report_queue_push_status(struct wiimote_state * state)
 {
   //push status report x20
   struct report * rpt = report_queue_push(state);
+  if (rpt == NULL) return;
+
   rpt->len = 8;
   rpt->data.io = 0xa1;
   rpt->data.type = 0x20;
@@ -87,7 +82,7 @@ void report_queue_push_status(struct wiimote_state * state)
 }
 
 void report_format_mem_resp(struct wiimote_state * state, struct report * rpt,
-  int size, int error, uint16_t addr, uint8_t * buf, bool encrypt)
+  int size, int error, uint16_t addr, const uint8_t * buf, bool encrypt)
 {
   struct report_mem_resp * resp = (struct report_mem_resp *)rpt->data.buf;
 
@@ -109,6 +104,40 @@ void report_format_mem_resp(struct wiimote_state * state, struct report * rpt,
   }
 }
 
+int report_next_mem_resp(struct wiimote_state * state, struct report * rpt)
+{
+  struct mem_read_request * req = &state->sys.mem_read;
+  struct report_mem_resp * resp = (struct report_mem_resp *)rpt->data.buf;
+  int size, i;
+
+  if (req->remaining == 0) return 0; //no read in progress
+
+  size = (req->remaining < 0x10) ? req->remaining : 0x10;
+
+  memset(rpt, 0, sizeof(struct report));
+  report_format_mem_resp(state, rpt, size, 0x0, req->addr, NULL, false);
+
+  //slice the chunk straight out of the source, reading as zero past its end
+  for (i = 0; i < size; i++)
+  {
+    if (req->position + i < req->source_size)
+    {
+      resp->data[i] = req->source[req->position + i];
+    }
+  }
+
+  if (req->encrypt)
+  {
+    ext_encrypt_bytes(&state->sys.extension_crypto_state, resp->data, req->addr & 0x7, size);
+  }
+
+  req->position += size;
+  req->addr += size;
+  req->remaining -= size;
+
+  return 1;
+}
+
 void report_append_buttons(struct wiimote_state * state, uint8_t * buf)
 {
   struct report_buttons * rpt = (struct report_buttons *)buf;
@@ -126,17 +155,18 @@ void report_append_buttons(struct wiimote_state * state, uint8_t * buf)
   rpt->home  = state->usr.home;
 }
 
-void report_append_accelerometer(struct wiimote_state * state, uint8_t * buf)
+//the 3 msb bytes go to buf, the lsbs into the button bytes
+void report_append_accelerometer(struct wiimote_state * state, uint8_t * buttons, uint8_t * buf)
 {
-  struct report_accelerometer * rpt = (struct report_accelerometer *)buf;
+  struct report_buttons * rpt = (struct report_buttons *)buttons;
 
-  rpt->buttons.accel_0 = state->usr.accel_x;
-  rpt->buttons.accel_1 = (state->usr.accel_z & 0x2) |
-                         ((state->usr.accel_y >> 1) & 0x1);
+  rpt->accel_0 = state->usr.accel_x;
+  rpt->accel_1 = (state->usr.accel_z & 0x2) |
+                 ((state->usr.accel_y >> 1) & 0x1);
 
-  rpt->x = state->usr.accel_x >> 2;
-  rpt->y = state->usr.accel_y >> 2;
-  rpt->z = state->usr.accel_z >> 2;
+  buf[0] = state->usr.accel_x >> 2;
+  buf[1] = state->usr.accel_y >> 2;
+  buf[2] = state->usr.accel_z >> 2;
 }
 
 void report_append_ir_10(struct wiimote_state * state, uint8_t * buf)
@@ -439,3 +469,106 @@ void report_append_extension(struct wiimote_state * state, uint8_t * buf, uint8_
     ext_encrypt_bytes(&state->sys.extension_crypto_state, buf, addr_offset, length);
   }
 }
+
+//always inlined so each per mode encoder below is folded down to just the
+//appends its layout needs, only sections flagged in dirty are rewritten
+static inline __attribute__((always_inline)) void report_encode(
+  struct wiimote_state * state, uint8_t * buf, const struct report_layout * layout, uint8_t dirty)
+{
+  if (layout->buttons >= 0 && (dirty & REPORT_DIRTY_BUTTONS))
+  {
+    report_append_buttons(state, buf + layout->buttons);
+  }
+
+  if (layout->accel >= 0 && (dirty & REPORT_DIRTY_ACCEL))
+  {
+    report_append_accelerometer(state, buf + layout->buttons, buf + layout->accel);
+  }
+
+  if (dirty & REPORT_DIRTY_IR)
+  {
+    switch (layout->ir_format)
+    {
+      case REPORT_IR_BASIC:
+        report_append_ir_10(state, buf + layout->ir);
+        break;
+      case REPORT_IR_EXTENDED:
+        report_append_ir_12(state, buf + layout->ir);
+        break;
+      case REPORT_IR_INTERLEAVED:
+        report_append_interleaved(state, buf + layout->buttons);
+        break;
+    }
+  }
+
+  if (layout->extension >= 0 && (dirty & REPORT_DIRTY_EXTENSION))
+  {
+    //the extension structs only set their own bits
+    memset(buf + layout->extension, 0, layout->extension_length);
+    report_append_extension(state, buf + layout->extension, layout->extension_length);
+  }
+}
+
+typedef void (*report_encoder)(struct wiimote_state * state, uint8_t * buf, uint8_t dirty);
+
+#define REPORT_ENCODER(mode) \
+  static void report_encode_##mode(struct wiimote_state * state, uint8_t * buf, uint8_t dirty) \
+  { \
+    report_encode(state, buf, &report_layouts[mode - REPORT_MODE_FIRST], dirty); \
+  }
+
+REPORT_ENCODER(0x30)
+REPORT_ENCODER(0x31)
+REPORT_ENCODER(0x32)
+REPORT_ENCODER(0x33)
+REPORT_ENCODER(0x34)
+REPORT_ENCODER(0x35)
+REPORT_ENCODER(0x36)
+REPORT_ENCODER(0x37)
+REPORT_ENCODER(0x3d)
+REPORT_ENCODER(0x3e)
+REPORT_ENCODER(0x3f)
+
+#undef REPORT_ENCODER
+
+static const report_encoder report_encoders[REPORT_MODE_LAST - REPORT_MODE_FIRST + 1] =
+{
+  report_encode_0x30, report_encode_0x31, report_encode_0x32, report_encode_0x33,
+  report_encode_0x34, report_encode_0x35, report_encode_0x36, report_encode_0x37,
+  NULL, NULL, NULL, NULL,
+  NULL, report_encode_0x3d, report_encode_0x3e, report_encode_0x3f,
+};
+
+int report_encode_input(struct wiimote_state * state, uint8_t type, uint8_t * buf)
+{
+  const struct report_layout * layout = report_get_layout(type);
+  uint8_t dirty = state->usr.dirty;
+
+  if (layout == NULL) return -1; //not an input data report
+
+  if (type != state->sys.encoded_mode || layout->ir_format == REPORT_IR_INTERLEAVED)
+  {
+    //cached payload is for another mode (or invalid), encode everything
+    //interleaved reports alternate halves, so they are never cached
+    memset(state->sys.encoded, 0, sizeof(state->sys.encoded));
+    state->sys.encoded_mode = type;
+    dirty = REPORT_DIRTY_ALL;
+  }
+  else if (state->sys.extension_report_type == 0x05 || state->sys.extension_report_type == 0x07)
+  {
+    //passthrough alternates motionplus and extension data every report
+    dirty |= REPORT_DIRTY_EXTENSION;
+  }
+
+  report_encoders[type - REPORT_MODE_FIRST](state, state->sys.encoded, dirty);
+  state->usr.dirty = 0;
+
+  memcpy(buf, state->sys.encoded, layout->length);
+
+  return layout->length;
+}
+
+void report_invalidate_cache(struct wiimote_state * state)
+{
+  state->sys.encoded_mode = 0;
+}
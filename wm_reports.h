@@ -4,30 +4,11 @@
 #define WM_REPORTS_H
 
 #include "wiimote.h"
+#include "wm_layout.h"
 #include <stdint.h>
 
 #define OFFSET24(offset32) ((offset32)<<8)
 
-struct report_data
-{
-  uint8_t io;
-  uint8_t type;
-  uint8_t buf[21];
-  uint8_t padding;
-} __attribute__((packed));
-
-struct report
-{
-  uint32_t len;  //data (packet) length
-  struct report_data data;
-};
-
-struct queued_report
-{
-  struct queued_report * next;
-  struct report rpt;
-};
-
 /* Output reports (from controller) */
 
 struct report_buttons
@@ -369,13 +350,17 @@ void report_queue_push_ack(struct wiimote_state *state, uint8_t report, uint8_t
 void report_queue_push_status(struct wiimote_state * state);
 
 void report_format_mem_resp(struct wiimote_state * state, struct report * rpt,
-  int size, int error, uint16_t addr, uint8_t * buf, bool encrypt);
+  int size, int error, uint16_t addr, const uint8_t * buf, bool encrypt);
+int report_next_mem_resp(struct wiimote_state * state, struct report * rpt);
 
 void report_append_buttons(struct wiimote_state * state, uint8_t * buf);
-void report_append_accelerometer(struct wiimote_state * state, uint8_t * buf);
+void report_append_accelerometer(struct wiimote_state * state, uint8_t * buttons, uint8_t * buf);
 void report_append_ir_10(struct wiimote_state * state, uint8_t * buf);
 void report_append_ir_12(struct wiimote_state * state, uint8_t * buf);
 void report_append_interleaved(struct wiimote_state * state, uint8_t * buf);
 void report_append_extension(struct wiimote_state * state, uint8_t * buf, uint8_t bytes);
 
+int report_encode_input(struct wiimote_state * state, uint8_t type, uint8_t * buf);
+void report_invalidate_cache(struct wiimote_state * state);
+
 #endif
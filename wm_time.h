@@ -0,0 +1,25 @@
+#ifndef WM_TIME_H
+#define WM_TIME_H
+
+#include <stdint.h>
+#include <time.h>
+
+//monotonic timestamp in microseconds, for timers and intervals (not wall time)
+static inline uint64_t wm_time_us(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * (uint64_t)1000000 + ts.tv_nsec / 1000;
+}
+
+//same clock in nanoseconds, for timing things that take microseconds
+static inline uint64_t wm_time_ns(void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+#endif
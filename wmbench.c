@@ -0,0 +1,281 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wiimote.h"
+#include "wm_reports.h"
+#include "wm_crypto.h"
+#include "wm_time.h"
+
+//times the report encoding hot path and the extension cipher, one csv row
+//per case: benchmark,mode,extension,variant,iterations,ns_per_op,ops_per_sec
+
+#define BENCH_ITERATIONS 200000
+
+struct bench_extension
+{
+  const char * name;
+  enum wiimote_connected_extension_type type;
+  int motionplus; //value written to a600fe, 0 to leave motion plus off
+};
+
+static const struct bench_extension extensions[] = {
+  { "none", NoExtension, 0 },
+  { "nunchuk", Nunchuk, 0 },
+  { "classic", Classic, 0 },
+  { "motionplus", NoExtension, 0x04 },
+  { "motionplus_nunchuk", Nunchuk, 0x05 },
+  { "motionplus_classic", Classic, 0x07 },
+};
+
+//how much of the input changes between reports
+enum bench_variant
+{
+  BENCH_FULL, //cache thrown away, every byte encoded
+  BENCH_CACHED, //nothing changed
+  BENCH_BUTTONS, //one button toggled
+};
+
+static const char * variant_names[] = { "full", "cached", "buttons" };
+
+static volatile uint32_t sink;
+
+static void write_row(FILE * out, const char * bench, int mode, const char * extension,
+  const char * variant, int iterations, uint64_t elapsed)
+{
+  double ns = (double)elapsed / iterations;
+
+  fprintf(out, "%s,", bench);
+  if (mode >= 0)
+  {
+    fprintf(out, "0x%02x", mode);
+  }
+  fprintf(out, ",%s,%s,%d,%.1f,%.0f\n", extension, variant, iterations, ns, 1e9 / ns);
+}
+
+//wiimote streaming the given mode with the extension plugged in and encrypted
+static void setup_wiimote(struct wiimote_state * state, const struct bench_extension * ext, uint8_t mode)
+{
+  static const uint8_t key[16] = {
+    0x2f, 0x9a, 0x31, 0x4c, 0x07, 0xd5, 0x6e, 0x18,
+    0xb2, 0x90, 0x5a, 0x43, 0xc1, 0x7d, 0x26, 0xe8
+  };
+  uint8_t buf[32];
+  uint8_t wmp = ext->motionplus;
+
+  wiimote_init(state);
+  state->usr.connected_extension_type = ext->type;
+
+  //plug the extension in and drop the status reports
+  do
+  {
+    generate_report(state, buf);
+  } while (wiimote_reply_pending(state));
+
+  if (wmp)
+  {
+    write_register(state, 0xa600fe, 1, &wmp);
+  }
+
+  //once motion plus is active it answers at a4, so its key goes there too
+  if (wmp || ext->type != NoExtension)
+  {
+    write_register(state, 0xa40040, 16, key);
+    write_register(state, 0xa4004c, 4, key + 12);
+  }
+
+  state->sys.reporting_mode = mode;
+  state->sys.reporting_continuous = true;
+
+  while (wiimote_reply_pending(state))
+  {
+    generate_report(state, buf);
+  }
+}
+
+static void bench_generate_report(FILE * out, int iterations)
+{
+  struct wiimote_state state;
+  uint8_t buf[32];
+  unsigned int e;
+  int mode, variant, i;
+  uint64_t start;
+
+  for (mode = REPORT_MODE_FIRST; mode <= REPORT_MODE_LAST; mode++)
+  {
+    if (report_get_layout(mode) == NULL) continue;
+
+    for (e = 0; e < sizeof(extensions) / sizeof(extensions[0]); e++)
+    {
+      for (variant = BENCH_FULL; variant <= BENCH_BUTTONS; variant++)
+      {
+        setup_wiimote(&state, &extensions[e], mode);
+
+        start = wm_time_ns();
+        for (i = 0; i < iterations; i++)
+        {
+          if (variant == BENCH_FULL)
+          {
+            report_invalidate_cache(&state);
+          }
+          else if (variant == BENCH_BUTTONS)
+          {
+            state.usr.a = !state.usr.a;
+            state.usr.dirty |= REPORT_DIRTY_BUTTONS;
+          }
+
+          sink += generate_report(&state, buf);
+        }
+        write_row(out, "generate_report", mode, extensions[e].name, variant_names[variant],
+          iterations, wm_time_ns() - start);
+
+        wiimote_destroy(&state);
+      }
+    }
+  }
+}
+
+static void bench_append_extension(FILE * out, int iterations)
+{
+  struct wiimote_state state;
+  uint8_t buf[32];
+  unsigned int e;
+  int i;
+  uint64_t start;
+
+  for (e = 1; e < sizeof(extensions) / sizeof(extensions[0]); e++)
+  {
+    setup_wiimote(&state, &extensions[e], 0x35);
+
+    start = wm_time_ns();
+    for (i = 0; i < iterations; i++)
+    {
+      report_append_extension(&state, buf, 16);
+      sink += buf[0];
+    }
+    write_row(out, "report_append_extension", -1, extensions[e].name, "", iterations, wm_time_ns() - start);
+
+    wiimote_destroy(&state);
+  }
+}
+
+static void bench_crypto(FILE * out, int iterations)
+{
+  static const int lengths[] = { 6, 16, 21 };
+  struct ext_crypto_state crypto;
+  uint8_t key[16];
+  uint8_t buf[32];
+  char variant[16];
+  unsigned int l;
+  int i;
+  uint64_t start;
+
+  for (i = 0; i < 16; i++)
+  {
+    key[i] = i * 17 + 3;
+  }
+  memset(buf, 0x5a, sizeof(buf));
+
+  start = wm_time_ns();
+  for (i = 0; i < iterations; i++)
+  {
+    key[0] = i;
+    ext_generate_tables(&crypto, key);
+    sink += crypto.ft[0];
+  }
+  write_row(out, "ext_generate_tables", -1, "", "", iterations, wm_time_ns() - start);
+
+  //a host re-sending one of a few keys
+  struct ext_key_cache cache;
+  memset(&cache, 0, sizeof(cache));
+
+  start = wm_time_ns();
+  for (i = 0; i < iterations; i++)
+  {
+    key[0] = i % 4;
+    ext_generate_tables_cached(&cache, &crypto, key);
+    sink += crypto.ft[0];
+  }
+  write_row(out, "ext_generate_tables_cached", -1, "", "", iterations, wm_time_ns() - start);
+
+  for (l = 0; l < sizeof(lengths) / sizeof(lengths[0]); l++)
+  {
+    snprintf(variant, sizeof(variant), "%d bytes", lengths[l]);
+
+    start = wm_time_ns();
+    for (i = 0; i < iterations; i++)
+    {
+      ext_encrypt_bytes(&crypto, buf, 0x08, lengths[l]);
+      sink += buf[0];
+    }
+    write_row(out, "ext_encrypt_bytes", -1, "", variant, iterations, wm_time_ns() - start);
+
+    start = wm_time_ns();
+    for (i = 0; i < iterations; i++)
+    {
+      ext_decrypt_bytes(&crypto, buf, 0x08, lengths[l]);
+      sink += buf[0];
+    }
+    write_row(out, "ext_decrypt_bytes", -1, "", variant, iterations, wm_time_ns() - start);
+  }
+}
+
+void print_usage(char * argv0)
+{
+  printf("usage: %s [ -n <iterations> ] [ -o <file.csv> ]\n", argv0);
+}
+
+int main(int argc, char *argv[])
+{
+  int iterations = BENCH_ITERATIONS;
+  const char * path = NULL;
+  FILE * out = stdout;
+  int i;
+
+  for (i = 1; i < argc; i++)
+  {
+    if (strcmp(argv[i], "-n") == 0 && i + 1 < argc)
+    {
+      iterations = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+    {
+      path = argv[++i];
+    }
+    else
+    {
+      print_usage(argv[0]);
+      return 1;
+    }
+  }
+
+  if (iterations <= 0)
+  {
+    print_usage(argv[0]);
+    return 1;
+  }
+
+  if (path != NULL)
+  {
+    out = fopen(path, "w");
+    if (out == NULL)
+    {
+      printf("Unable to open %s\n", path);
+      return 1;
+    }
+  }
+
+  fprintf(out, "benchmark,mode,extension,variant,iterations,ns_per_op,ops_per_sec\n");
+
+  bench_generate_report(out, iterations);
+  bench_append_extension(out, iterations);
+  bench_crypto(out, iterations);
+
+  if (out != stdout)
+  {
+    fclose(out);
+    printf("results written to %s\n", path);
+  }
+
+  return 0;
+}
@@ -1,9 +1,9 @@
+#define _GNU_SOURCE //recvmmsg
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
 #include <errno.h>
 #include <bluetooth/bluetooth.h>
-#include <bluetooth/l2cap.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <arpa/inet.h>
@@ -12,6 +12,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <poll.h>
+#include <sys/epoll.h>
 #include <pthread.h>
 
 #include "sdp.h"
@@ -21,20 +22,46 @@
 #include "input_socket.h"
 #include "adapter.h"
 #include "wm_print.h"
+#include "report_scheduler.h"
+#include "playback_clock.h"
+#include "dtm_reader.h"
+#include "event_loop.h"
+#include "transport.h"
 
-#define PSM_SDP 1
-#define PSM_CTRL 0x11
-#define PSM_INT 0x13
+//reports read from the int channel per recvmmsg call
+#define INT_RECV_BATCH 16
+
+//most tas reports sent in one go when playback has fallen behind
+#define PLAYBACK_MAX_BURST 8
 
 bdaddr_t host_bdaddr;
 int has_host = 0;
 
-int sdp_fd, ctrl_fd, int_fd;
-int sock_sdp_fd, sock_ctrl_fd, sock_int_fd;
+int sdp_fd = -1, ctrl_fd = -1, int_fd = -1;
+int sock_sdp_fd = -1, sock_ctrl_fd = -1, sock_int_fd = -1;
 
 static int is_connected = 0;
 
 static bool playback_tas = false;
+static bool playback_waiting = false; //for the next movie to be decoded
+static struct playback_clock playback;
+unsigned int playback_speed = 100; //percent, what the playback clock runs at
+unsigned int playback_speed_request; //set by input_update, checked by the clock
+int playback_seek; //report or frame number, set by input_update
+bool playback_seek_frame;
+
+//l2cap unless -loopback was given
+static struct transport * transport = &transport_l2cap;
+static bool loopback = false;
+
+static struct event_loop loop;
+static struct report_scheduler sched;
+static unsigned char buf[256];
+
+//set by the fd handlers, consumed once per main loop iteration
+static int report_due;
+static int input_pending;
+static int playback_due;
 
 //signal handler to break out of main loop
 static int running = 1;
@@ -43,196 +70,414 @@ void sig_handler(int sig)
   running = 0;
 }
 
-int create_socket()
+int listen_for_connections()
 {
-  int fd;
-  struct linger l = { .l_onoff = 1, .l_linger = 5 };
-  int opt = 0;
+#ifdef SDP_SERVER
+  sock_sdp_fd = transport->listen(NULL, PSM_SDP);
+  if (sock_sdp_fd < 0)
+  {
+    printf("can't listen on psm %d: %s\n", PSM_SDP, strerror(errno));
+    return -1;
+  }
+#endif
 
-  fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
-  if (fd < 0)
+  sock_ctrl_fd = transport->listen(NULL, PSM_CTRL);
+  if (sock_ctrl_fd < 0)
   {
+    printf("can't listen on psm %d: %s\n", PSM_CTRL, strerror(errno));
     return -1;
   }
 
-  if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l)) < 0)
+  sock_int_fd = transport->listen(NULL, PSM_INT);
+  if (sock_int_fd < 0)
   {
-    close(fd);
+    printf("can't listen on psm %d: %s\n", PSM_INT, strerror(errno));
     return -1;
   }
 
-  if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt)) < 0)
+  return 0;
+}
+
+int connect_to_host()
+{
+  ctrl_fd = transport->connect(NULL, &host_bdaddr, PSM_CTRL);
+  if (ctrl_fd < 0)
   {
-    close(fd);
+    printf("can't connect to host psm %d: %s\n", PSM_CTRL, strerror(errno));
     return -1;
   }
 
-  if (setsockopt(fd, SOL_L2CAP, L2CAP_LM, &opt, sizeof(opt)) < 0)
+  int_fd = transport->connect(NULL, &host_bdaddr, PSM_INT);
+  if (int_fd < 0)
   {
-    close(fd);
+    printf("can't connect to host psm %d: %s\n", PSM_INT, strerror(errno));
     return -1;
   }
 
-  return fd;
+  return 0;
 }
 
-int l2cap_connect(bdaddr_t bdaddr, int psm)
+static void close_connection(int * fd)
 {
-  int fd;
-  struct sockaddr_l2 addr;
+  if (*fd < 0) return;
 
-  fd = create_socket();
-  if (fd < 0)
+  event_loop_remove(&loop, *fd);
+  shutdown(*fd, SHUT_RDWR);
+  close(*fd);
+  *fd = -1;
+}
+
+void disconnect()
+{
+  close_connection(&sdp_fd);
+  close_connection(&ctrl_fd);
+  close_connection(&int_fd);
+}
+
+static void handle_sdp(int fd, uint32_t events, void * data)
+{
+  ssize_t len;
+
+  if (events & EPOLLIN)
   {
-    return -1;
+    while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
+    {
+      sdp_recv_data(buf, len);
+    }
   }
 
-  memset(&addr, 0, sizeof(addr));
-  addr.l2_family = AF_BLUETOOTH;
-  addr.l2_psm    = htobs(psm);
-  addr.l2_bdaddr = bdaddr;
+  //answer right away, edge triggered POLLOUT won't fire again
+  while ((len = sdp_get_data(buf)) > 0)
+  {
+    send(fd, buf, len, MSG_DONTWAIT);
+  }
+}
 
-  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+static void handle_ctrl(int fd, uint32_t events, void * data)
+{
+  if (events & EPOLLERR)
   {
-    close(fd);
-    return -1;
+    printf("error on ctrl psm\n");
+    running = 0;
+    return;
   }
 
-  return fd;
+  //nothing is expected on the control channel, discard it
+  while (recv(fd, buf, sizeof(buf), MSG_DONTWAIT) > 0);
 }
 
-int l2cap_listen(int psm)
+static int int_writable()
 {
-  int fd;
-  struct sockaddr_l2 addr;
+  struct pollfd out_pfd = { .fd = int_fd, .events = POLLOUT };
 
-  fd = create_socket();
-  if (fd < 0)
-  {
-    return -1;
-  }
+  return poll(&out_pfd, 1, 0) > 0 && (out_pfd.revents & POLLOUT);
+}
 
-  memset(&addr, 0, sizeof(addr));
-  addr.l2_family = AF_BLUETOOTH;
-  addr.l2_psm = htobs(psm);
-  addr.l2_bdaddr = *BDADDR_ANY;
+//sends queued acks and memory reads now instead of on the next tick,
+//so handshakes with the wii aren't paced by the report rate
+static void flush_replies(struct wiimote_state * state)
+{
+  ssize_t len;
 
-  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+  while (wiimote_reply_pending(state) && int_writable())
   {
-    close(fd);
-    return -1;
-  }
+    //not a tick, so the hotplug delay and eeprom flush aren't advanced
+    len = generate_reply(state, buf);
+    if (len <= 0) break;
 
-  if (listen(fd, 1) < 0)
-  {
-    close(fd);
-    return -1;
+    print_report(buf, len);
+    send(int_fd, buf, len, MSG_DONTWAIT);
   }
-
-  return fd;
 }
 
-int listen_for_connections()
+//hands every report waiting on the int channel to process_report, in order
+static void drain_int(int fd, struct wiimote_state * state)
 {
-#ifdef SDP_SERVER
-  sock_sdp_fd = l2cap_listen(PSM_SDP);
-  if (sock_sdp_fd < 0)
+  ssize_t len;
+
+#ifdef __linux__
+  static bool use_mmsg = true;
+  static unsigned char msg_bufs[INT_RECV_BATCH][64];
+  struct mmsghdr msgs[INT_RECV_BATCH];
+  struct iovec iovs[INT_RECV_BATCH];
+  int count, i;
+
+  while (use_mmsg)
   {
-    printf("can't listen on psm %d: %s\n", PSM_SDP, strerror(errno));
-    return -1;
+    memset(msgs, 0, sizeof(msgs));
+    for (i = 0; i < INT_RECV_BATCH; i++)
+    {
+      iovs[i].iov_base = msg_bufs[i];
+      iovs[i].iov_len = sizeof(msg_bufs[i]);
+      msgs[i].msg_hdr.msg_iov = &iovs[i];
+      msgs[i].msg_hdr.msg_iovlen = 1;
+    }
+
+    count = recvmmsg(fd, msgs, INT_RECV_BATCH, MSG_DONTWAIT, NULL);
+    if (count < 0)
+    {
+      if (errno != ENOSYS) return; //drained (or the socket failed)
+
+      //kernel without recvmmsg, use plain recv from now on
+      use_mmsg = false;
+      break;
+    }
+
+    for (i = 0; i < count; i++)
+    {
+      if (msgs[i].msg_len == 0) continue;
+
+      print_report(msg_bufs[i], msgs[i].msg_len);
+      process_report(state, msg_bufs[i], msgs[i].msg_len);
+      playback_clock_host_report(&playback);
+    }
+
+    if (count < INT_RECV_BATCH) return;
   }
 #endif
 
-  sock_ctrl_fd = l2cap_listen(PSM_CTRL);
-  if (sock_ctrl_fd < 0)
+  while ((len = recv(fd, buf, sizeof(buf), MSG_DONTWAIT)) > 0)
   {
-    printf("can't listen on psm %d: %s\n", PSM_CTRL, strerror(errno));
-    return -1;
+    print_report(buf, len);
+    process_report(state, buf, len);
+    playback_clock_host_report(&playback);
   }
+}
 
-  sock_int_fd = l2cap_listen(PSM_INT);
-  if (sock_int_fd < 0)
+static void handle_int(int fd, uint32_t events, void * data)
+{
+  struct wiimote_state * state = data;
+
+  if (events & EPOLLERR)
   {
-    printf("can't listen on psm %d: %s\n", PSM_INT, strerror(errno));
-    return -1;
+    printf("error on data psm\n");
+    running = 0;
+    return;
   }
 
-  return 0;
+  drain_int(fd, state);
+  flush_replies(state);
+
+  //host output reports pace playback in host mode
+  playback_due = playback_tas;
 }
 
-int accept_connection(int socket_fd, bdaddr_t * bdaddr)
+static void handle_timer(int fd, uint32_t events, void * data)
 {
-  int fd;
-  struct sockaddr_l2 addr;
-  socklen_t opt = sizeof(addr);
+  report_due = (report_scheduler_fire(&sched) > 0);
+}
 
-  fd = accept(socket_fd, (struct sockaddr *)&addr, &opt);
-  if (fd < 0)
-  {
-    return -1;
-  }
+static void handle_playback(int fd, uint32_t events, void * data)
+{
+  playback_clock_fire(&playback);
+  playback_due = 1;
+}
 
-  if (bdaddr != NULL)
+static void handle_dtm_loaded(int fd, uint32_t events, void * data)
+{
+  dtm_playlist_loaded();
+
+  //carry on from when the movie is ready rather than catching up
+  if (playback_tas && playback_waiting)
   {
-    *bdaddr = addr.l2_bdaddr;
+    playback_waiting = false;
+    playback_clock_resync(&playback);
+    playback_due = 1;
   }
+}
 
-  return fd;
+static void stop_tas(void)
+{
+  playback_tas = false;
+  playback_waiting = false;
+  playback_clock_stop(&playback);
+  playback_clock_print_stats(&playback);
 }
 
-int connect_to_host()
+//sends every tas report the playback clock says is due
+static void play_tas(struct wiimote_state * state)
 {
-  ctrl_fd = l2cap_connect(host_bdaddr, PSM_CTRL);
-  if (ctrl_fd < 0)
-  {
-    printf("can't connect to host psm %d: %s\n", PSM_CTRL, strerror(errno));
-    return -1;
-  }
+  ssize_t len;
+  int burst = 0;
 
-  int_fd = l2cap_connect(host_bdaddr, PSM_INT);
-  if (int_fd < 0)
+  while (burst < PLAYBACK_MAX_BURST && playback_clock_due(&playback) > 0 && int_writable())
   {
-    printf("can't connect to host psm %d: %s\n", PSM_INT, strerror(errno));
-    return -1;
+    len = next_dtm_report(state, buf);
+    if (len < 0)
+    {
+      //picked up again by handle_dtm_loaded
+      playback_waiting = true;
+      return;
+    }
+    if (len == 0)
+    {
+      stop_tas();
+      return;
+    }
+
+    print_report(buf, len);
+    send(int_fd, buf, len, MSG_DONTWAIT);
+    playback_clock_sent(&playback);
+    burst++;
   }
+}
 
-  return 0;
+static void handle_input(int fd, uint32_t events, void * data)
+{
+  //input_update drains the source
+  input_pending = 1;
 }
 
-void disconnect()
+static void watch_connection(int fd, event_handler handler, void * data)
 {
-  shutdown(sdp_fd, SHUT_RDWR);
-  shutdown(ctrl_fd, SHUT_RDWR);
-  shutdown(int_fd, SHUT_RDWR);
+  event_loop_add(&loop, fd, EPOLLIN | EPOLLET, handler, data);
+}
+
+static void watch_host(struct wiimote_state * state)
+{
+  watch_connection(ctrl_fd, handle_ctrl, NULL);
+  watch_connection(int_fd, handle_int, state);
+}
+
+static void handle_listen(int fd, uint32_t events, void * data)
+{
+  struct wiimote_state * state = data;
+
+  //listening sockets are level triggered, one connection per wakeup
+  if (fd == sock_sdp_fd)
+  {
+    close_connection(&sdp_fd);
+    sdp_fd = transport->accept(fd, NULL);
+    if (sdp_fd < 0)
+    {
+      printf("error accepting sdp connection\n");
+      running = 0;
+      return;
+    }
+    watch_connection(sdp_fd, handle_sdp, NULL);
+  }
+  else if (fd == sock_ctrl_fd)
+  {
+    close_connection(&ctrl_fd);
+    ctrl_fd = transport->accept(fd, NULL);
+    if (ctrl_fd < 0)
+    {
+      printf("error accepting ctrl connection\n");
+      running = 0;
+      return;
+    }
+    watch_connection(ctrl_fd, handle_ctrl, NULL);
+  }
+  else if (fd == sock_int_fd)
+  {
+    close_connection(&int_fd);
+    int_fd = transport->accept(fd, &host_bdaddr);
+    if (int_fd < 0)
+    {
+      printf("error accepting int connection\n");
+      running = 0;
+      return;
+    }
+    watch_connection(int_fd, handle_int, state);
 
-  close(sdp_fd);
-  close(ctrl_fd);
-  close(int_fd);
+    char straddr[18];
+    ba2str(&host_bdaddr, straddr);
+    printf("connected to %s\n", straddr);
 
-  sdp_fd = 0;
-  ctrl_fd = 0;
-  int_fd = 0;
+    is_connected = 1;
+    has_host = 1;
+  }
 }
 
 void print_usage(char *argv0)
 {
-  printf("usage: %s [ <wii-bdaddr> [ gui | unix <path> | ip <port> ] ]\n", argv0);
+  printf("usage: %s [ -rate <hz> ] [ -playback-rate <hz> | -playback-host ] [ -playback-speed <percent> ]\n"
+    "  [ [ -taskey <key.txt> ] -tas <movie.dtm> ... ] [ -loopback <dir> ]\n"
+    "  [ <wii-bdaddr> [ gui | unix <path> | ip <port> ] ]\n", argv0);
 }
 
 int main(int argc, char *argv[])
 {
   struct input_source input_source;
 
-  struct pollfd pfd[6];
-  unsigned char buf[256];
   ssize_t len;
 
   struct wiimote_state state;
 
-  int send_report_now = 1;
+  unsigned int report_rate = REPORT_RATE_DEFAULT;
+  unsigned int playback_rate = PLAYBACK_RATE_DEFAULT;
+  enum playback_clock_mode playback_mode = PLAYBACK_CLOCK_FIXED;
+  const char * tas_key = DEFAULT_KEY;
+  char * argv0 = argv[0];
+
+  int input_fd;
+  int dtm_fd;
   int input_result;
   int failure = 0;
 
+  //options come before the positional arguments
+  while (argc > 1 && argv[1][0] == '-')
+  {
+    if (strcmp(argv[1], "-rate") == 0 && argc > 2)
+    {
+      report_rate = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "-playback-rate") == 0 && argc > 2)
+    {
+      playback_rate = atoi(argv[2]);
+      playback_mode = PLAYBACK_CLOCK_FIXED;
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "-playback-host") == 0)
+    {
+      playback_mode = PLAYBACK_CLOCK_HOST;
+      argc -= 1;
+      argv += 1;
+    }
+    else if (strcmp(argv[1], "-playback-speed") == 0 && argc > 2)
+    {
+      playback_speed = atoi(argv[2]);
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "-taskey") == 0 && argc > 2)
+    {
+      //applies to the -tas options after it
+      tas_key = argv[2];
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "-tas") == 0 && argc > 2)
+    {
+      if (dtm_playlist_add(argv[2], tas_key, true) < 0)
+      {
+        return 1;
+      }
+      argc -= 2;
+      argv += 2;
+    }
+    else if (strcmp(argv[1], "-loopback") == 0 && argc > 2)
+    {
+      if (transport_loopback_init(argv[2]) < 0)
+      {
+        return 1;
+      }
+      transport = &transport_loopback;
+      loopback = true;
+      argc -= 2;
+      argv += 2;
+    }
+    else
+    {
+      print_usage(argv0);
+      return 1;
+    }
+  }
+  argv[0] = argv0;
+
   if (argc > 1)
   {
     if (strcmp(argv[1], "pair") == 0)
@@ -276,14 +521,15 @@ int main(int argc, char *argv[])
   signal(SIGTERM, sig_handler);
   signal(SIGHUP, sig_handler);
   
-  if (set_up_device(NULL) < 0)
+  //no adapter to configure over loopback
+  if (!loopback && set_up_device(NULL) < 0)
   {
     printf("failed to set up Bluetooth device\n");
     return 1;
   }
 
 #ifndef SDP_SERVER
-  if (register_wiimote_sdp_record() < 0)
+  if (!loopback && register_wiimote_sdp_record() < 0)
   {
     printf("failed to add Wiimote SDP record\n");
     restore_device();
@@ -293,6 +539,47 @@ int main(int argc, char *argv[])
 
   wiimote_init(&state);
 
+  if (event_loop_init(&loop) < 0)
+  {
+    printf("failed to set up event loop\n");
+    running = 0;
+  }
+
+  if (report_scheduler_init(&sched, report_rate) < 0)
+  {
+    printf("failed to start report timer\n");
+    running = 0;
+  }
+  else
+  {
+    event_loop_add(&loop, sched.fd, EPOLLIN | EPOLLET, handle_timer, NULL);
+  }
+
+  if (playback_clock_init(&playback, playback_mode, playback_rate, playback_speed) < 0)
+  {
+    running = 0;
+  }
+  else
+  {
+    event_loop_add(&loop, playback.fd, EPOLLIN | EPOLLET, handle_playback, NULL);
+  }
+
+  dtm_fd = dtm_playlist_init();
+  if (dtm_fd < 0)
+  {
+    running = 0;
+  }
+  else
+  {
+    event_loop_add(&loop, dtm_fd, EPOLLIN, handle_dtm_loaded, NULL);
+  }
+
+  input_fd = input_source.get_fd();
+  if (input_fd >= 0)
+  {
+    event_loop_add(&loop, input_fd, EPOLLIN | EPOLLET, handle_input, NULL);
+  }
+
   if (has_host)
   {
     printf("connecting to host...\n");
@@ -307,6 +594,7 @@ int main(int argc, char *argv[])
       ba2str(&host_bdaddr, straddr);
       printf("connected to %s\n", straddr);
 
+      watch_host(&state);
       is_connected = 1;
     }
   }
@@ -319,135 +607,77 @@ int main(int argc, char *argv[])
     }
     else
     {
+      if (sock_sdp_fd >= 0)
+      {
+        event_loop_add(&loop, sock_sdp_fd, EPOLLIN, handle_listen, &state);
+      }
+      event_loop_add(&loop, sock_ctrl_fd, EPOLLIN, handle_listen, &state);
+      event_loop_add(&loop, sock_int_fd, EPOLLIN, handle_listen, &state);
+
       printf("listening for connections... (press wii's sync button)\n");
     }
   }
 
   while (running)
   {
-    memset(&pfd, 0, sizeof(pfd));
-
-    pfd[0].fd = sock_sdp_fd;
-    pfd[1].fd = sock_ctrl_fd;
-    pfd[2].fd = sock_int_fd;
-
-    pfd[3].fd = sdp_fd;
-
-    pfd[4].fd = ctrl_fd;
-    pfd[5].fd = int_fd;
-
-    if (!is_connected)
-    {
-      pfd[0].events = POLLIN;
-      pfd[1].events = POLLIN;
-      pfd[2].events = POLLIN;
-
-      pfd[3].events = POLLIN | POLLOUT;
-    }
-    else
-    {
-      pfd[4].events = POLLIN;
-      pfd[5].events = POLLIN;
-
-      pfd[5].events |= POLLOUT;
-    }
+    report_due = 0;
+    input_pending = 0;
+    playback_due = 0;
 
-    if (poll(pfd, 6, 20) < 0)
+    //the report timer wakes the loop at least once per report period
+    if (event_loop_dispatch(&loop, -1) < 0)
     {
       printf("poll error\n");
       break;
     }
 
-    if (pfd[4].revents & POLLERR)
+    if (!running)
     {
-      printf("error on ctrl psm\n");
-      break;
-    }
-    if (pfd[5].revents & POLLERR)
-    {
-      printf("error on data psm\n");
       break;
     }
 
-    if (pfd[0].revents & POLLIN)
-    {
-      sdp_fd = accept_connection(pfd[0].fd, NULL);
-      if (sdp_fd < 0)
-      {
-        printf("error accepting sdp connection\n");
-        break;
-      }
-    }
-    if (pfd[1].revents & POLLIN)
+    //input is still read during playback, for the playback controls
+    if (input_pending || report_due || input_fd < 0)
     {
-      ctrl_fd = accept_connection(pfd[1].fd, NULL);
-      if (ctrl_fd < 0)
-      {
-        printf("error accepting ctrl connection\n");
-        break;
-      }
+      input_result = input_update(&state, &input_source);
     }
-    if (pfd[2].revents & POLLIN)
+    else
     {
-      int_fd = accept_connection(pfd[2].fd, &host_bdaddr);
-      if (int_fd < 0)
-      {
-        printf("error accepting int connection\n");
-        break;
-      }
-
-      char straddr[18];
-      ba2str(&host_bdaddr, straddr);
-      printf("connected to %s\n", straddr);
-
-      is_connected = 1;
-      has_host = 1;
+      input_result = 0;
     }
 
-    if (pfd[3].revents & POLLIN)
+    if (input_result == -3)
     {
-      len = recv(sdp_fd, buf, 32, MSG_DONTWAIT);
-      if (len > 0)
+      if (!playback_tas && dtm_playlist_start() == 0)
       {
-        sdp_recv_data(buf, len);
+        playback_tas = true;
+        playback_clock_start(&playback);
+        playback_due = 1;
       }
     }
-    if (pfd[3].revents & POLLOUT)
+    else if (input_result == -4)
     {
-      len = sdp_get_data(buf);
-      if (len > 0)
+      //out of range speeds are turned down and the old one stays
+      if (playback_clock_set_speed(&playback, playback_speed_request) == 0)
       {
-        send(sdp_fd, buf, len, MSG_DONTWAIT);
+        playback_speed = playback_speed_request;
       }
     }
-
-    if (pfd[5].revents & POLLIN)
+    else if (input_result == -5)
     {
-      len = recv(int_fd, buf, 32, MSG_DONTWAIT);
-      if (len > 0)
+      //also works before playback starts, it then starts from there
+      if (playback_seek >= 0 &&
+        (playback_seek_frame ? seek_dtm_frame(&state, playback_seek) : seek_dtm_report(&state, playback_seek)) == 0 &&
+        playback_tas)
       {
-        print_report(buf, len);
-        process_report(&state, buf, len);
+        playback_clock_resync(&playback);
+        playback_due = 1;
       }
     }
-
-    if (playback_tas) // skip processing other input (speedup)
-    { // possibly dont skip to allow for ctrl+c exit (?)
-      input_result = 0;
-    }
-    else
-    {
-      input_result = input_update(&state, &input_source);
-    }
-
-    if (input_result == -3)
-    {
-      playback_tas = true;
-    }
     else if (input_result)
     {
       running = 0;
-      if (input_result == -2)
+      if (input_result == -2 && !loopback)
       {
         power_off_host(&host_bdaddr);
       }
@@ -457,31 +687,27 @@ int main(int argc, char *argv[])
       }
     }
 
-    if (is_connected && send_report_now)
+    if (is_connected && (report_due || playback_due))
     {
-      if (pfd[5].revents & POLLOUT)
+      if (int_writable())
       {
         if (playback_tas)
         {
-          len = next_dtm_report(&state, buf);
+          play_tas(&state);
         }
-        else
+        else if (report_due)
         {
           len = generate_report(&state, buf);
-        }
-        if (len > 0)
-        {
-          print_report(buf, len);
-          send(int_fd, buf, len, MSG_DONTWAIT);
-        }
-        else
-        {
-          playback_tas = false;
+          if (len > 0)
+          {
+            print_report(buf, len);
+            send(int_fd, buf, len, MSG_DONTWAIT);
+          }
         }
 
         failure = 0;
       }
-      else
+      else if (report_due)
       {
         if (++failure > 5)
         {
@@ -496,11 +722,14 @@ int main(int argc, char *argv[])
     {
       if (connect_to_host() < 0)
       {
+        close_connection(&ctrl_fd);
+        close_connection(&int_fd);
         usleep(500*1000);
       }
       else
       {
         printf("connected to host\n");
+        watch_host(&state);
         is_connected = 1;
       }
     }
@@ -508,17 +737,32 @@ int main(int argc, char *argv[])
 
   printf("cleaning up...\n");
 
+  report_scheduler_print_stats(&sched);
+  if (playback_tas)
+  {
+    stop_tas();
+  }
+  printf("extension key cache: %u hits, %u misses\n", state.key_cache.hits, state.key_cache.misses);
+
   disconnect();
 
-  close(sock_sdp_fd);
-  close(sock_ctrl_fd);
-  close(sock_int_fd);
+  if (sock_sdp_fd >= 0) close(sock_sdp_fd);
+  if (sock_ctrl_fd >= 0) close(sock_ctrl_fd);
+  if (sock_int_fd >= 0) close(sock_int_fd);
 
-  restore_device();
+  report_scheduler_close(&sched);
+  playback_clock_close(&playback);
+  dtm_playlist_clear();
+  event_loop_close(&loop);
+
+  if (!loopback)
+  {
+    restore_device();
 
 #ifndef SDP_SERVER
-  unregister_wiimote_sdp_record();
+    unregister_wiimote_sdp_record();
 #endif
+  }
 
   wiimote_destroy(&state);
   input_source.unload();
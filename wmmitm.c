@@ -3,7 +3,6 @@
 #include <unistd.h>
 #include <errno.h>
 #include <bluetooth/bluetooth.h>
-#include <bluetooth/l2cap.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <arpa/inet.h>
@@ -13,143 +12,109 @@
 #include <string.h>
 #include <poll.h>
 #include <pthread.h>
-#include <string.h>
-#include <chrono> // C++ requirement
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/prctl.h>
 
 #include "sdp.h"
 #include "adapter.h"
 #include "wm_print.h"
 #include "visualizer.h"
-
-#define PSM_SDP 1
-#define PSM_CTRL 0x11
-#define PSM_INT 0x13
+#include "transport.h"
+#include "spsc_ring.h"
+#include "latency_histogram.h"
+#include "capture.h"
+#include "wm_time.h"
 
 bdaddr_t host_device_bdaddr;
 bdaddr_t wiimote_device_bdaddr;
 bdaddr_t host_bdaddr;
 bdaddr_t wiimote_bdaddr;
 
-int sdp_fd, ctrl_fd, int_fd;
-int wm_ctrl_fd, wm_int_fd;
-int sock_sdp_fd, sock_ctrl_fd, sock_int_fd;
+int sdp_fd = -1, ctrl_fd = -1, int_fd = -1;
+int wm_ctrl_fd = -1, wm_int_fd = -1;
+int sock_sdp_fd = -1, sock_ctrl_fd = -1, sock_int_fd = -1;
 
 extern int show_reports;
 
 static int has_host = 0;
 static int is_connected = 0;
 
-//signal handler to break out of main loop
+//l2cap unless -loopback was given
+static struct transport * transport = &transport_l2cap;
+static bool loopback = false;
+
+//stand-in adapter addresses over loopback, the wiimote side is whatever
+//-wm names (wmemulator listens as 00:00:00:00:00:00)
+static const char * loopback_host_device = "00:00:00:00:00:01";
+static const char * loopback_wiimote_device = "00:00:00:00:00:02";
+
+//how long the main thread sleeps in poll between draining the taps
+#define TAP_POLL_MS 5
+
+static int output_max_delay = 2500;
+static bool enable_report_printing = false;
+
+//each forwarding thread pushes a copy of what it forwards onto its own tap,
+//the main thread drains both for key sniffing, printing and the visualizer.
+//a full tap drops the copy, forwarding never waits on it
+static struct spsc_ring host_tap; //wiimote -> console
+static struct spsc_ring wiimote_tap; //console -> wiimote
+
+static pthread_t to_host_thread;
+static pthread_t to_wiimote_thread;
+static bool forwarding = false;
+//written once to wake both forwarding threads out of poll when stopping
+static int stop_fd = -1;
+
+//time from recv to send in each direction, in ns. each is written only by
+//its forwarding thread and printed by the main thread
+static struct latency_histogram to_host_latency;
+static struct latency_histogram to_wiimote_latency;
+//wiimote reports forwarded, and how many extra sends the resend timer made
+static uint64_t reports_forwarded;
+static uint64_t reports_resent;
+
+//-capture, the file and the writer behind it
+static const char * capture_path = NULL;
+static struct capture capture;
+
+//seconds between stats printouts, 0 for only on SIGUSR1 and at exit
+static int stats_interval = 0;
+static int stats_requested = 0;
+
+//signal handler to break out of main loop, also stops the forwarding threads
 static int running = 1;
 void sig_handler(int sig)
 {
   running = 0;
 }
 
-int create_socket()
+static bool is_running()
 {
-  int fd;
-  struct linger l = { .l_onoff = 1, .l_linger = 5 };
-  int opt = 0;
-
-  fd = socket(AF_BLUETOOTH, SOCK_SEQPACKET, BTPROTO_L2CAP);
-  if (fd < 0)
-  {
-    return -1;
-  }
-
-  if (setsockopt(fd, SOL_SOCKET, SO_LINGER, &l, sizeof(l)) < 0)
-  {
-    close(fd);
-    return -1;
-  }
-
-  if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &opt, sizeof(opt)) < 0)
-  {
-    close(fd);
-    return -1;
-  }
-
-  if (setsockopt(fd, SOL_L2CAP, L2CAP_LM, &opt, sizeof(opt)) < 0)
-  {
-    close(fd);
-    return -1;
-  }
-
-  return fd;
+  return __atomic_load_n(&running, __ATOMIC_RELAXED);
 }
 
-int l2cap_connect(bdaddr_t device_bdaddr, bdaddr_t bdaddr, int psm)
+static void stop_running()
 {
-  int fd;
-  struct sockaddr_l2 addr;
-
-  fd = create_socket();
-  if (fd < 0)
-  {
-    return -1;
-  }
-
-  memset(&addr, 0, sizeof(addr));
-  addr.l2_family = AF_BLUETOOTH;
-  addr.l2_psm    = htobs(psm);
-  addr.l2_bdaddr = device_bdaddr;
-
-  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-  {
-    close(fd);
-    return -1;
-  }
-
-  memset(&addr, 0, sizeof(addr));
-  addr.l2_family = AF_BLUETOOTH;
-  addr.l2_psm    = htobs(psm);
-  addr.l2_bdaddr = bdaddr;
-
-  if (connect(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-  {
-    close(fd);
-    return -1;
-  }
-
-  return fd;
+  __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
 }
 
-int l2cap_listen(bdaddr_t device_bdaddr, int psm)
+void stats_handler(int sig)
 {
-  int fd;
-  struct sockaddr_l2 addr;
-
-  fd = create_socket();
-  if (fd < 0)
-  {
-    return -1;
-  }
-
-  memset(&addr, 0, sizeof(addr));
-  addr.l2_family = AF_BLUETOOTH;
-  addr.l2_psm = htobs(psm);
-  addr.l2_bdaddr = device_bdaddr;
-
-  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
-  {
-    close(fd);
-    return -1;
-  }
-
-  if (listen(fd, 1) < 0)
-  {
-    close(fd);
-    return -1;
-  }
+  stats_requested = 1;
+}
 
-  return fd;
+//single writer counters, see latency_record
+static void count_report(uint64_t * counter)
+{
+  __atomic_store_n(counter, *counter + 1, __ATOMIC_RELAXED);
 }
 
 int listen_for_connections()
 {
 #ifdef SDP_SERVER
-  sock_sdp_fd = l2cap_listen(host_device_bdaddr, PSM_SDP);
+  sock_sdp_fd = transport->listen(&host_device_bdaddr, PSM_SDP);
   if (sock_sdp_fd < 0)
   {
     printf("can't listen on psm %d: %s\n", PSM_SDP, strerror(errno));
@@ -157,14 +122,14 @@ int listen_for_connections()
   }
 #endif
 
-  sock_ctrl_fd = l2cap_listen(host_device_bdaddr, PSM_CTRL);
+  sock_ctrl_fd = transport->listen(&host_device_bdaddr, PSM_CTRL);
   if (sock_ctrl_fd < 0)
   {
     printf("can't listen on psm %d: %s\n", PSM_CTRL, strerror(errno));
     return -1;
   }
 
-  sock_int_fd = l2cap_listen(host_device_bdaddr, PSM_INT);
+  sock_int_fd = transport->listen(&host_device_bdaddr, PSM_INT);
   if (sock_int_fd < 0)
   {
     printf("can't listen on psm %d: %s\n", PSM_INT, strerror(errno));
@@ -174,36 +139,16 @@ int listen_for_connections()
   return 0;
 }
 
-int accept_connection(int socket_fd, bdaddr_t * bdaddr)
-{
-  int fd;
-  struct sockaddr_l2 addr;
-  socklen_t opt = sizeof(addr);
-
-  fd = accept(socket_fd, (struct sockaddr *)&addr, &opt);
-  if (fd < 0)
-  {
-    return -1;
-  }
-
-  if (bdaddr != NULL)
-  {
-    *bdaddr = addr.l2_bdaddr;
-  }
-
-  return fd;
-}
-
 int connect_to_host()
 {
-  ctrl_fd = l2cap_connect(host_device_bdaddr, host_bdaddr, PSM_CTRL);
+  ctrl_fd = transport->connect(&host_device_bdaddr, &host_bdaddr, PSM_CTRL);
   if (ctrl_fd < 0)
   {
     printf("can't connect to host psm %d: %s\n", PSM_CTRL, strerror(errno));
     return -1;
   }
 
-  int_fd = l2cap_connect(host_device_bdaddr, host_bdaddr, PSM_INT);
+  int_fd = transport->connect(&host_device_bdaddr, &host_bdaddr, PSM_INT);
   if (int_fd < 0)
   {
     printf("can't connect to host psm %d: %s\n", PSM_INT, strerror(errno));
@@ -215,14 +160,14 @@ int connect_to_host()
 
 int connect_to_wiimote()
 {
-  wm_ctrl_fd = l2cap_connect(wiimote_device_bdaddr, wiimote_bdaddr, PSM_CTRL);
+  wm_ctrl_fd = transport->connect(&wiimote_device_bdaddr, &wiimote_bdaddr, PSM_CTRL);
   if (wm_ctrl_fd < 0)
   {
     printf("can't connect to wiimote psm %d: %s\n", PSM_CTRL, strerror(errno));
     return -1;
   }
 
-  wm_int_fd = l2cap_connect(wiimote_device_bdaddr, wiimote_bdaddr, PSM_INT);
+  wm_int_fd = transport->connect(&wiimote_device_bdaddr, &wiimote_bdaddr, PSM_INT);
   if (wm_int_fd < 0)
   {
     printf("can't connect to wiimote psm %d: %s\n", PSM_INT, strerror(errno));
@@ -242,9 +187,9 @@ void disconnect_from_host()
   close(ctrl_fd);
   close(int_fd);
 
-  sdp_fd = 0;
-  ctrl_fd = 0;
-  int_fd = 0;
+  sdp_fd = -1;
+  ctrl_fd = -1;
+  int_fd = -1;
 }
 
 void disconnect_from_wiimote()
@@ -255,32 +200,375 @@ void disconnect_from_wiimote()
   close(wm_ctrl_fd);
   close(wm_int_fd);
 
-  wm_ctrl_fd = 0;
-  wm_int_fd = 0;
+  wm_ctrl_fd = -1;
+  wm_int_fd = -1;
 }
 
-int main(int argc, char *argv[])
+//resend timer, one shot output_max_delay us from now, or disarmed
+static void arm_resend(int timer_fd, bool arm)
 {
-  struct pollfd pfd[8];
+  struct itimerspec its;
+
+  memset(&its, 0, sizeof(its));
+  if (arm)
+  {
+    its.it_value.tv_sec = output_max_delay / 1000000;
+    its.it_value.tv_nsec = (output_max_delay % 1000000) * 1000;
+  }
+  timerfd_settime(timer_fd, 0, &its, NULL);
+}
+
+//wiimote -> console. the last input report is sent again every
+//output_max_delay us while the wiimote keeps streaming the same 0x37 reports
+void * forward_to_host(void * arg)
+{
+  struct pollfd pfd[4];
 
-  unsigned char buf[256];
-  ssize_t len;
   unsigned char in_buf[256];
   ssize_t in_buf_len = 0;
-  unsigned char out_buf[256];
-  ssize_t out_buf_len = 0;
   unsigned char saved_buf[256];
   ssize_t saved_buf_len = 0;
 
+  bool wm_datatype_changed = true;
+  bool send_pending = false; //saved_buf is waiting for the console to take it
+  uint64_t recv_ns = 0; //when saved_buf came in, 0 if pending is a resend
+  uint64_t expirations;
+
+  int timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (timer_fd < 0)
+  {
+    printf("Unable to create resend timer: %s\n", strerror(errno));
+    stop_running();
+    return NULL;
+  }
+
+  //the default 50us of slack would push every resend late
+  prctl(PR_SET_TIMERSLACK, 1);
+
+  while (is_running())
+  {
+    //while a report waits on the console, the wiimote waits too
+    pfd[0].fd = wm_int_fd;
+    pfd[0].events = send_pending ? 0 : POLLIN;
+    pfd[0].revents = 0;
+    pfd[1].fd = int_fd;
+    pfd[1].events = send_pending ? POLLOUT : 0;
+    pfd[1].revents = 0;
+    pfd[2].fd = timer_fd;
+    pfd[2].events = POLLIN;
+    pfd[2].revents = 0;
+    pfd[3].fd = stop_fd;
+    pfd[3].events = POLLIN;
+    pfd[3].revents = 0;
+
+    if (poll(pfd, 4, -1) < 0)
+    {
+      if (errno == EINTR) continue;
+      printf("poll error\n");
+      break;
+    }
+
+    if (pfd[0].revents & POLLERR)
+    {
+      printf("error on wm data psm\n");
+      break;
+    }
+    if (pfd[1].revents & POLLERR)
+    {
+      printf("error on wii data psm\n");
+      break;
+    }
+    //poll reports a hangup whether asked or not, it would spin here forever
+    if ((pfd[0].revents | pfd[1].revents) & POLLHUP)
+    {
+      printf("%s disconnected\n", (pfd[0].revents & POLLHUP) ? "wiimote" : "host");
+      break;
+    }
+
+    if (pfd[2].revents & POLLIN)
+    {
+      read(timer_fd, &expirations, sizeof(expirations));
+      //a fresh report still waiting on the console stays fresh, it is the resend
+      if (!send_pending && saved_buf_len > 0 && !wm_datatype_changed)
+      {
+        send_pending = true;
+        recv_ns = 0;
+        pfd[1].revents |= POLLOUT; //try right away, poll again only if it won't go
+      }
+    }
+
+    if (send_pending && (pfd[1].revents & POLLOUT))
+    {
+      if (send(int_fd, saved_buf, saved_buf_len, MSG_DONTWAIT) >= 0 || errno != EAGAIN)
+      {
+        send_pending = false;
+        //the next resend is due output_max_delay after this one
+        arm_resend(timer_fd, !wm_datatype_changed);
+
+        if (recv_ns != 0)
+        {
+          latency_record(&to_host_latency, wm_time_ns() - recv_ns);
+        }
+        else
+        {
+          count_report(&reports_resent);
+        }
+      }
+    }
+
+    if (!send_pending && (pfd[0].revents & POLLIN))
+    {
+      in_buf_len = recv(wm_int_fd, in_buf, 32, MSG_DONTWAIT); // only 23 needed for any wiimote extension?
+      if (in_buf_len <= 0)
+      {
+        continue;
+      }
+      recv_ns = wm_time_ns();
+      count_report(&reports_forwarded);
+
+      // very crudely detect when it's okay to spam the console with reports
+      wm_datatype_changed = in_buf[1] != 0x37 || in_buf[1] != saved_buf[1] || in_buf_len != saved_buf_len;
+      saved_buf_len = in_buf_len;
+      memcpy(saved_buf, in_buf, in_buf_len);
+
+      //new data goes out immediately
+      if (send(int_fd, saved_buf, saved_buf_len, MSG_DONTWAIT) < 0 && errno == EAGAIN)
+      {
+        send_pending = true;
+      }
+      else
+      {
+        latency_record(&to_host_latency, wm_time_ns() - recv_ns);
+        arm_resend(timer_fd, !wm_datatype_changed);
+      }
+
+      spsc_ring_push(&host_tap, in_buf, in_buf_len, recv_ns / 1000);
+      if (capture.started)
+      {
+        capture_input(&capture, in_buf, in_buf_len, recv_ns / 1000);
+      }
+    }
+  }
+
+  close(timer_fd);
+  stop_running();
+  return NULL;
+}
+
+//console -> wiimote, output reports go straight through
+void * forward_to_wiimote(void * arg)
+{
+  struct pollfd pfd[3];
+
+  unsigned char out_buf[256];
+  ssize_t out_buf_len = 0;
+  uint64_t recv_ns = 0;
+
+  while (is_running())
+  {
+    pfd[2].fd = stop_fd;
+    pfd[2].events = POLLIN;
+    pfd[2].revents = 0;
+    pfd[0].fd = int_fd;
+    pfd[0].events = out_buf_len == 0 ? POLLIN : 0;
+    pfd[0].revents = 0;
+    pfd[1].fd = wm_int_fd;
+    pfd[1].events = out_buf_len > 0 ? POLLOUT : 0;
+    pfd[1].revents = 0;
+
+    if (poll(pfd, 3, -1) < 0)
+    {
+      if (errno == EINTR) continue;
+      printf("poll error\n");
+      break;
+    }
+
+    if (pfd[0].revents & POLLERR)
+    {
+      printf("error on wii data psm\n");
+      break;
+    }
+    if (pfd[1].revents & POLLERR)
+    {
+      printf("error on wm data psm\n");
+      break;
+    }
+    if ((pfd[0].revents | pfd[1].revents) & POLLHUP)
+    {
+      printf("%s disconnected\n", (pfd[0].revents & POLLHUP) ? "host" : "wiimote");
+      break;
+    }
+
+    if (out_buf_len == 0 && (pfd[0].revents & POLLIN))
+    {
+      out_buf_len = recv(int_fd, out_buf, 32, MSG_DONTWAIT);
+      if (out_buf_len <= 0)
+      {
+        out_buf_len = 0;
+        continue;
+      }
+      recv_ns = wm_time_ns();
+
+      spsc_ring_push(&wiimote_tap, out_buf, out_buf_len, recv_ns / 1000);
+      if (capture.started)
+      {
+        capture_output(&capture, out_buf, out_buf_len, recv_ns / 1000);
+      }
+    }
+    if (out_buf_len > 0 && (pfd[1].revents & POLLOUT))
+    {
+      send(wm_int_fd, out_buf, out_buf_len, MSG_DONTWAIT);
+      out_buf_len = 0;
+      latency_record(&to_wiimote_latency, wm_time_ns() - recv_ns);
+    }
+  }
+
+  stop_running();
+  return NULL;
+}
+
+void print_forwarding_stats()
+{
+  struct latency_histogram hist;
+  uint64_t forwarded = __atomic_load_n(&reports_forwarded, __ATOMIC_RELAXED);
+  uint64_t resent = __atomic_load_n(&reports_resent, __ATOMIC_RELAXED);
+
+  latency_snapshot(&to_host_latency, &hist);
+  latency_print("wiimote -> console", &hist);
+  latency_snapshot(&to_wiimote_latency, &hist);
+  latency_print("console -> wiimote", &hist);
+
+  if (forwarded > 0)
+  {
+    printf("resends: %llu for %llu wiimote reports, %.2fx sent\n",
+      (unsigned long long)resent, (unsigned long long)forwarded,
+      (double)(forwarded + resent) / forwarded);
+  }
+}
+
+int start_forwarding()
+{
+  //opened first, the forwarding threads only check it's there
+  if (capture_path != NULL)
+  {
+    if (capture_open(&capture, capture_path, host_device_bdaddr.b, wiimote_device_bdaddr.b,
+      host_bdaddr.b, wiimote_bdaddr.b) < 0)
+    {
+      return -1;
+    }
+    printf("capturing to %s\n", capture_path);
+  }
+
+  stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (stop_fd < 0)
+  {
+    printf("Unable to create stop event: %s\n", strerror(errno));
+    capture_close(&capture);
+    return -1;
+  }
+
+  if (pthread_create(&to_host_thread, NULL, forward_to_host, NULL) != 0)
+  {
+    printf("can't start wiimote -> console thread\n");
+    close(stop_fd);
+    stop_fd = -1;
+    capture_close(&capture);
+    return -1;
+  }
+
+  if (pthread_create(&to_wiimote_thread, NULL, forward_to_wiimote, NULL) != 0)
+  {
+    printf("can't start console -> wiimote thread\n");
+    stop_running();
+    eventfd_write(stop_fd, 1);
+    pthread_join(to_host_thread, NULL);
+    close(stop_fd);
+    stop_fd = -1;
+    capture_close(&capture);
+    return -1;
+  }
+
+  forwarding = true;
+  return 0;
+}
+
+void stop_forwarding()
+{
+  if (!forwarding) return;
+
+  stop_running();
+  eventfd_write(stop_fd, 1);
+  pthread_join(to_host_thread, NULL);
+  pthread_join(to_wiimote_thread, NULL);
+  forwarding = false;
+
+  close(stop_fd);
+  stop_fd = -1;
+
+  capture_close(&capture);
+  print_forwarding_stats();
+
+  if (spsc_ring_dropped(&host_tap) > 0 || spsc_ring_dropped(&wiimote_tap) > 0)
+  {
+    printf("tap dropped %llu input and %llu output reports\n",
+      (unsigned long long)spsc_ring_dropped(&host_tap),
+      (unsigned long long)spsc_ring_dropped(&wiimote_tap));
+  }
+}
+
+//everything that only watches the stream, off the forwarding path
+void drain_taps()
+{
+  const struct spsc_ring_slot * slot;
+  unsigned char last_buf[SPSC_RING_SLOT];
+  int last_len = 0;
+
+  //output reports first, so a key written before these inputs is in place
+  while ((slot = spsc_ring_peek(&wiimote_tap)) != NULL)
+  {
+    //the key is only known here, it goes to the capture the same way
+    if (store_extension_key(slot->data, slot->len) && capture.started)
+    {
+      capture_key(&capture, extension_key(), slot->time);
+    }
+    if (enable_report_printing)
+    {
+      print_report(slot->data, slot->len);
+    }
+    spsc_ring_pop(&wiimote_tap);
+  }
+
+  while ((slot = spsc_ring_peek(&host_tap)) != NULL)
+  {
+    if (enable_report_printing)
+    {
+      print_report(slot->data, slot->len);
+    }
+    last_len = slot->len;
+    memcpy(last_buf, slot->data, last_len);
+    spsc_ring_pop(&host_tap);
+  }
+
+  //one frame for however many reports came in since the last one
+  if (last_len > 0)
+  {
+    visualize_inputs(last_buf, last_len);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  struct pollfd pfd[6];
+
+  unsigned char buf[256];
+  ssize_t len;
+
   int failure = 0;
 
-  bool enable_report_printing = false;
   show_reports = 1;
   
-  int output_max_delay = 2500;
   int poll_retval = 0;
-  bool wm_datatype_changed = true;
-  auto start = std::chrono::steady_clock::now();
+  uint64_t next_stats = 0;
 
   bool bad_arg = false;
   for (int i = 1; i < argc; ++i)
@@ -294,7 +582,7 @@ int main(int argc, char *argv[])
       }
       else
       {
-      	str2ba(argv[2], &host_bdaddr);
+      	str2ba(argv[i], &host_bdaddr);
         has_host = 1;
       }
     }
@@ -328,65 +616,100 @@ int main(int argc, char *argv[])
     {
       enable_report_printing = true;
     }
+    else if (!strcmp(argv[i], "-capture") && i + 1 < argc)
+    {
+      i++;
+      capture_path = argv[i];
+    }
+    else if (!strcmp(argv[i], "-stats") && i + 1 < argc)
+    {
+      i++;
+      stats_interval = atoi(argv[i]);
+      if (stats_interval <= 0)
+      {
+        bad_arg = true;
+        stats_interval = 0;
+      }
+    }
+    else if (!strcmp(argv[i], "-loopback") && i + 1 < argc)
+    {
+      i++;
+      if (transport_loopback_init(argv[i]) < 0)
+      {
+        return 1;
+      }
+      transport = &transport_loopback;
+      loopback = true;
+    }
   }
     
   if (bad_arg)
   {
-    printf("Some arguments ignored. Proper usage: %s -wm <wiimote-bdaddr> -wii <wii-bdaddr> -d <max forwarding delay> -debug\n", *argv);
+    printf("Some arguments ignored. Proper usage: %s -wm <wiimote-bdaddr> -wii <wii-bdaddr> -d <max forwarding delay> -debug -stats <seconds> -capture <file> -loopback <dir>\n", *argv);
   }
 
   //set up unload signals
   signal(SIGINT, sig_handler);
   signal(SIGTERM, sig_handler);
   signal(SIGHUP, sig_handler);
+  signal(SIGUSR1, stats_handler);
 
-  if (set_up_device(NULL) < 0)
+  if (loopback)
   {
-    printf("failed to set up Bluetooth device\n");
-    return 1;
+    //no adapters, the wiimote is found at the -wm address
+    str2ba(loopback_host_device, &host_device_bdaddr);
+    str2ba(loopback_wiimote_device, &wiimote_device_bdaddr);
   }
-
-  if (get_device_bdaddr(0, &host_device_bdaddr) < 0)
-  {
-    printf("failed to get host Bluetooth adapter address\n");
-    restore_device();
-    return 1;
-  }
-
-  if (get_device_bdaddr(1, &wiimote_device_bdaddr) < 0)
+  else
   {
-    printf("failed to get Wiimote Bluetooth adapter address\n");
-    printf("Warning: two Bluetooth adapters are required for proper functionality\n");
-    wiimote_device_bdaddr = host_device_bdaddr;
-  }
+    if (set_up_device(NULL) < 0)
+    {
+      printf("failed to set up Bluetooth device\n");
+      return 1;
+    }
 
-#ifndef SDP_SERVER
-  if (register_wiimote_sdp_record() < 0)
-  {
-    printf("failed to add Wiimote SDP record\n");
-    restore_device();
-    return 1;
-  }
-#endif
+    if (get_device_bdaddr(0, &host_device_bdaddr) < 0)
+    {
+      printf("failed to get host Bluetooth adapter address\n");
+      restore_device();
+      return 1;
+    }
 
-  printf("connecting to wiimote... (press wiimote's sync button)\n");
+    if (get_device_bdaddr(1, &wiimote_device_bdaddr) < 0)
+    {
+      printf("failed to get Wiimote Bluetooth adapter address\n");
+      printf("Warning: two Bluetooth adapters are required for proper functionality\n");
+      wiimote_device_bdaddr = host_device_bdaddr;
+    }
 
-  while (!bacmp(&wiimote_bdaddr, BDADDR_ANY))
-  {
-    if (failure++ > 3)
+#ifndef SDP_SERVER
+    if (register_wiimote_sdp_record() < 0)
     {
-      printf("couldn't find a wiimote to connect to\n");
+      printf("failed to add Wiimote SDP record\n");
       restore_device();
       return 1;
     }
+#endif
 
-    find_wiimote(&wiimote_bdaddr);
+    printf("connecting to wiimote... (press wiimote's sync button)\n");
+
+    while (!bacmp(&wiimote_bdaddr, BDADDR_ANY))
+    {
+      if (failure++ > 3)
+      {
+        printf("couldn't find a wiimote to connect to\n");
+        restore_device();
+        return 1;
+      }
+
+      find_wiimote(&wiimote_bdaddr);
+    }
   }
 
   if (connect_to_wiimote() < 0)
   {
     printf("failed to connect to wiimote\n");
-    restore_device();
+    if (!loopback) restore_device();
     return 1;
   }
 
@@ -422,7 +745,7 @@ int main(int argc, char *argv[])
   
   init_visualizer();
 
-  while (running)
+  while (is_running())
   {
     memset(&pfd, 0, sizeof(pfd));
 
@@ -433,10 +756,7 @@ int main(int argc, char *argv[])
     pfd[3].fd = sdp_fd;
 
     pfd[4].fd = ctrl_fd;
-    pfd[5].fd = int_fd;
-
-    pfd[6].fd = wm_ctrl_fd;
-    pfd[7].fd = wm_int_fd;
+    pfd[5].fd = wm_ctrl_fd;
 
     if (!is_connected)
     {
@@ -445,32 +765,16 @@ int main(int argc, char *argv[])
       pfd[2].events = POLLIN;
 
       pfd[3].events = POLLIN | POLLOUT;
-      poll_retval = poll(pfd, 4, 5);
+      poll_retval = poll(pfd, 4, TAP_POLL_MS);
     }
     else
     {
-      pfd[4].events = POLLIN;
-      pfd[5].events = POLLIN;
-      pfd[6].events = POLLIN;
-      pfd[7].events = POLLIN;
-      
-      auto now = std::chrono::steady_clock::now();
-      int micro_sec = (int)std::chrono::duration_cast<std::chrono::microseconds>(now - start).count(); // time between POLLOUT
-
-      if (in_buf_len > 0 || (saved_buf_len > 0 && !wm_datatype_changed && micro_sec >= output_max_delay))
-      {
-        pfd[5].events |= POLLOUT;
-        start = now;
-      }
-      if (out_buf_len > 0)
-      {
-        pfd[7].events |= POLLOUT;
-      }
-      // polling only the wiimote or only the console speeds it up a negligible amount
-      poll_retval = poll(pfd + 4, 4, 0); // poll both
+      //the data psms belong to the forwarding threads, this only catches errors
+      //on the ctrl psms while waiting for something to show up on the taps
+      poll_retval = poll(pfd + 4, 2, TAP_POLL_MS);
     }
 
-    if (poll_retval < 0)
+    if (poll_retval < 0 && errno != EINTR)
     {
       printf("poll error\n");
       break;
@@ -482,24 +786,14 @@ int main(int argc, char *argv[])
       break;
     }
     if (pfd[5].revents & POLLERR)
-    {
-      printf("error on wii data psm\n");
-      break;
-    }
-    if (pfd[6].revents & POLLERR)
     {
       printf("error on wm ctrl psm\n");
       break;
     }
-    if (pfd[7].revents & POLLERR)
-    {
-      printf("error on wm data psm\n");
-      break;
-    }
 
     if (pfd[0].revents & POLLIN)
     {
-      sdp_fd = accept_connection(pfd[0].fd, NULL);
+      sdp_fd = transport->accept(pfd[0].fd, NULL);
       if (sdp_fd < 0)
       {
         printf("error accepting sdp connection\n");
@@ -508,7 +802,7 @@ int main(int argc, char *argv[])
     }
     if (pfd[1].revents & POLLIN)
     {
-      ctrl_fd = accept_connection(pfd[1].fd, NULL);
+      ctrl_fd = transport->accept(pfd[1].fd, NULL);
       if (ctrl_fd < 0)
       {
         printf("error accepting ctrl connection\n");
@@ -517,7 +811,7 @@ int main(int argc, char *argv[])
     }
     if (pfd[2].revents & POLLIN)
     {
-      int_fd = accept_connection(pfd[2].fd, &host_bdaddr);
+      int_fd = transport->accept(pfd[2].fd, &host_bdaddr);
       if (int_fd < 0)
       {
         printf("error accepting int connection\n");
@@ -549,79 +843,40 @@ int main(int argc, char *argv[])
       }
     }
 
-    if (is_connected)
+    if (has_host && !is_connected)
     {
-      if (out_buf_len == 0 && (pfd[5].revents & POLLIN))
+      if (connect_to_host() < 0)
       {
-        out_buf_len = recv(int_fd, out_buf, 32, MSG_DONTWAIT);
-        store_extension_key(out_buf, out_buf_len);
-        /*if (out_buf[1] == 0x12) { // not sure why, but when this is set, you can't spam the console right away
-          cts_reporting = out_buf[2] & 0x04 ? CTS_REPORTING_ENABLED : 0;
-        }*/
-        if (enable_report_printing)
-        {
-          print_report(out_buf, out_buf_len);
-        }
+        usleep(500*1000);
       }
-      if (pfd[5].revents & POLLOUT)
+      else
       {
-        if (saved_buf_len > 0)
-        {
-          send(int_fd, saved_buf, saved_buf_len, MSG_DONTWAIT);
-          in_buf_len = 0; // flag for first send after receiving new data from wiimote
-        }
-
-        failure = 0;
+        printf("connected to host\n");
+        is_connected = 1;
       }
-      // else
-      // {
-      //   if (++failure > 3)
-      //   {
-      //     printf("connection timed out, attemping to reconnect...\n");
-      //     disconnect_from_host();
-      //     is_connected = 0;
-      //   }
-
-      //   usleep(20*1000*1000);
-      // }
     }
 
-    if (in_buf_len == 0 && (pfd[7].revents & POLLIN))
+    if (is_connected && !forwarding && start_forwarding() < 0)
     {
-      in_buf_len = recv(wm_int_fd, in_buf, 32, MSG_DONTWAIT); // only 23 needed for any wiimote extension?
-      // very crudely detect when it's okay to spam the console with reports
-      wm_datatype_changed = in_buf[1] != 0x37 || in_buf[1] != saved_buf[1] || in_buf_len != saved_buf_len;
-      saved_buf_len = in_buf_len;
-      memcpy(saved_buf, in_buf, in_buf_len);
-      
-      visualize_inputs(in_buf, in_buf_len);
-      
-      if (enable_report_printing)
-      {
-        print_report(in_buf, in_buf_len);
-      }
+      break;
     }
-    if (out_buf_len > 0 && (pfd[7].revents & POLLOUT))
+
+    drain_taps();
+
+    if (forwarding && stats_interval > 0 && wm_time_us() >= next_stats)
     {
-      send(wm_int_fd, out_buf, out_buf_len, MSG_DONTWAIT);
-      out_buf_len = 0;
+      if (next_stats != 0) stats_requested = 1;
+      next_stats = wm_time_us() + stats_interval * (uint64_t)1000000;
     }
-
-    if (has_host && !is_connected)
+    if (stats_requested)
     {
-      if (connect_to_host() < 0)
-      {
-        usleep(500*1000);
-      }
-      else
-      {
-        printf("connected to host\n");
-        is_connected = 1;
-      }
+      stats_requested = 0;
+      print_forwarding_stats();
     }
   }
 
   printf("cleaning up...\n");
+  stop_forwarding();
   exit_visualizer();
 
   disconnect_from_host();
@@ -631,11 +886,14 @@ int main(int argc, char *argv[])
   close(sock_ctrl_fd);
   close(sock_int_fd);
 
-  restore_device();
+  if (!loopback)
+  {
+    restore_device();
 
 #ifndef SDP_SERVER
-  unregister_wiimote_sdp_record();
+    unregister_wiimote_sdp_record();
 #endif
+  }
 
   return 0;
 }